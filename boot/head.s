@@ -110,8 +110,8 @@ setup_gdt:
 
 /*
  * I put the kernel page tables right after the page directory,
- * using 4 of them to span 16 Mb of physical memory. People with
- * more than 16MB will have to expand this.
+ * using 4 of them to span 16 Mb of physical memory. mem_init() maps
+ * anything above that.
  */
 .org 0x1000
 pg0:
@@ -228,14 +228,14 @@ idt_descr:
 .align 2
 .word 0
 gdt_descr:
-	.word 256*8-1		# so does gdt (not that that's any
-	.long gdt		# magic number, but it works for me :^)
+	.word 516*8-1		# 4 + a TSS and an LDT for each of
+	.long gdt		# NR_TASKS (256) tasks, see sched.h
 
 	.align 8
 idt:	.fill 256,8,0		# idt is uninitialized
 
 gdt:	.quad 0x0000000000000000	/* NULL descriptor */
-	.quad 0x00c09a0000000fff	/* 16Mb */
-	.quad 0x00c0920000000fff	/* 16Mb */
+	.quad 0x00cf9a000000ffff	/* 4Gb, mm maps all of memory */
+	.quad 0x00cf92000000ffff	/* 4Gb */
 	.quad 0x0000000000000000	/* TEMPORARY - don't use */
-	.fill 252,8,0			/* space for LDT's and TSS's etc */
+	.fill 512,8,0			/* space for LDT's and TSS's etc */
@@ -10,6 +10,9 @@
 #include <linux/sched.h>
 #include <linux/kernel.h>
 
+#define PREALLOC_ZONES 8
+#define NR_PREALLOC 32
+
 #define clear_block(addr) \
 __asm__ __volatile__ ("cld\n\t" \
 	"rep\n\t" \
@@ -22,28 +25,60 @@ __asm__ __volatile__("btsl %2,%3\n\tsetb %%al": \
 "=a" (res):"0" (0),"r" (nr),"m" (*(addr))); \
 res;})
 
+#define test_bit(nr,addr) ({\
+register int res ; \
+__asm__ __volatile__("btl %2,%3\n\tsetb %%al": \
+"=a" (res):"0" (0),"r" (nr),"m" (*(addr))); \
+res;})
+
 #define clear_bit(nr,addr) ({\
 register int res ; \
 __asm__ __volatile__("btrl %2,%3\n\tsetnb %%al": \
 "=a" (res):"0" (0),"r" (nr),"m" (*(addr))); \
 res;})
 
-#define find_first_zero(addr) ({ \
+/* the lowest set bit of a word that isn't zero */
+#define first_bit(word) ({ \
 int __res; \
-__asm__ __volatile__ ("cld\n" \
-	"1:\tlodsl\n\t" \
-	"notl %%eax\n\t" \
-	"bsfl %%eax,%%edx\n\t" \
-	"je 2f\n\t" \
-	"addl %%edx,%%ecx\n\t" \
-	"jmp 3f\n" \
-	"2:\taddl $32,%%ecx\n\t" \
-	"cmpl $8192,%%ecx\n\t" \
-	"jl 1b\n" \
-	"3:" \
-	:"=c" (__res):"c" (0),"S" (addr)); \
+__asm__ ("bsfl %1,%0":"=r" (__res):"rm" (word)); \
 __res;})
 
+static long nr_zone_allocs = 0, nr_goal_hits = 0, nr_inode_allocs = 0;
+static long nr_words_scanned = 0, nr_prealloc = 0, nr_prealloc_wasted = 0;
+
+/*
+ * Find a zero bit among the first 'nr' bits of the bitmap in 'map',
+ * looking a word at a time from bit 'start' on and going round to the
+ * beginning. Returns -1 if they are all set.
+ */
+static int find_zero(struct buffer_head ** map, int nr, int start)
+{
+	struct buffer_head * bh;
+	unsigned long word;
+	int words = (nr+31) >> 5;
+	int i, k, bit;
+
+	if (start < 0 || start >= nr)
+		start = 0;
+	i = start >> 5;
+	for (k = 0 ; k <= words ; k++, i++) {
+		if (i >= words)
+			i = 0;
+		nr_words_scanned++;
+		if (!(bh = map[i >> 8]))
+			continue;
+		word = ~((unsigned long *) bh->b_data)[i & 255];
+		if (!k)
+			word &= ~0UL << (start & 31);
+		if (!word)
+			continue;
+		bit = (i << 5) + first_bit(word);
+		if (bit < nr)
+			return bit;
+	}
+	return -1;
+}
+
 void free_block(int dev, int block)
 {
 	struct super_block * sb;
@@ -72,28 +107,12 @@ void free_block(int dev, int block)
 	sb->s_zmap[block/8192]->b_dirt = 1;
 }
 
-int new_block(int dev)
+/* a zone that has just been allocated starts out as zeroes */
+static void clear_zone(int dev, int block)
 {
 	struct buffer_head * bh;
-	struct super_block * sb;
-	int i,j;
 
-	if (!(sb = get_super(dev)))
-		panic("trying to get new block from nonexistant device");
-	j = 8192;
-	for (i=0 ; i<8 ; i++)
-		if ((bh=sb->s_zmap[i]))
-			if ((j=find_first_zero(bh->b_data))<8192)
-				break;
-	if (i>=8 || !bh || j>=8192)
-		return 0;
-	if (set_bit(j,bh->b_data))
-		panic("new_block: bit already set");
-	bh->b_dirt = 1;
-	j += i*8192 + sb->s_firstdatazone-1;
-	if (j >= sb->s_nzones)
-		return 0;
-	if (!(bh=getblk(dev,j)))
+	if (!(bh=getblk(dev,block)))
 		panic("new_block: cannot get block");
 	if (bh->b_count != 1)
 		panic("new block: count is != 1");
@@ -101,9 +120,175 @@ int new_block(int dev)
 	bh->b_uptodate = 1;
 	bh->b_dirt = 1;
 	brelse(bh);
+}
+
+/*
+ * Files that are being extended in order have the zones after their
+ * last block reserved for them: i_prealloc_count of them from zone
+ * i_prealloc on. Reservations are only kept here, in memory, and not in
+ * the bitmap, so a crash loses nothing. new_block() passes over them,
+ * and lets them all go if nothing else is left.
+ */
+static struct m_inode * prealloc_table[NR_PREALLOC];
+
+/* the inode that has 'zone' of 'dev' reserved, if any */
+static struct m_inode * reserved(int dev, int zone)
+{
+	struct m_inode * inode;
+	int i;
+
+	for (i = 0 ; i < NR_PREALLOC ; i++)
+		if ((inode = prealloc_table[i]) && inode->i_prealloc_count &&
+		    inode->i_dev == dev && zone >= inode->i_prealloc &&
+		    zone < inode->i_prealloc + inode->i_prealloc_count)
+			return inode;
+	return NULL;
+}
+
+/*
+ * Give back the zones that were reserved for 'inode' and not used. That
+ * happens when it stops growing in order, is truncated, or is no longer
+ * in use.
+ */
+void discard_prealloc(struct m_inode * inode)
+{
+	int i;
+
+	nr_prealloc_wasted += inode->i_prealloc_count;
+	inode->i_prealloc_count = 0;
+	for (i = 0 ; i < NR_PREALLOC ; i++)
+		if (prealloc_table[i] == inode)
+			prealloc_table[i] = NULL;
+}
+
+/* let all reservations on 'dev' go */
+static void discard_all_prealloc(int dev)
+{
+	struct m_inode * inode;
+	int i;
+
+	for (i = 0 ; i < NR_PREALLOC ; i++)
+		if ((inode = prealloc_table[i]) && inode->i_dev == dev)
+			discard_prealloc(inode);
+}
+
+/*
+ * Allocate a zone, at 'goal' if it is free or as soon after it as can be
+ * found, so that the blocks of a file end up next to each other. Without
+ * a goal the search goes on from where the last one left off, instead of
+ * from the start of the bitmap each time.
+ */
+int new_block(int dev, int goal)
+{
+	struct buffer_head * bh;
+	struct super_block * sb;
+	struct m_inode * r;
+	int j, n, start;
+
+	if (!(sb = get_super(dev)))
+		panic("trying to get new block from nonexistant device");
+	if (goal >= sb->s_firstdatazone && goal < sb->s_nzones)
+		goal -= sb->s_firstdatazone-1;
+	else
+		goal = -1;
+	start = (goal < 0) ? sb->s_zcursor : goal;
+	for (n = 0 ; ; n++) {
+		j = find_zero(sb->s_zmap,sb->s_nzones-sb->s_firstdatazone+1,start);
+		if (j < 0)
+			return 0;
+		if (!(r = reserved(dev,j+sb->s_firstdatazone-1)))
+			break;
+/* gone round all the reservations: only reserved zones are free */
+		if (n > NR_PREALLOC) {
+			discard_all_prealloc(dev);
+			continue;
+		}
+		start = r->i_prealloc + r->i_prealloc_count -
+			(sb->s_firstdatazone-1);
+	}
+	bh = sb->s_zmap[j>>13];
+	if (set_bit(j&8191,bh->b_data))
+		panic("new_block: bit already set");
+	bh->b_dirt = 1;
+	nr_zone_allocs++;
+	if (j == goal)
+		nr_goal_hits++;
+	sb->s_zcursor = j+1;
+	j += sb->s_firstdatazone-1;
+	clear_zone(dev,j);
 	return j;
 }
 
+/*
+ * Reserve for 'inode' up to 'nr' zones from 'block' on, stopping at the
+ * first one that is used or reserved already. Returns how many it got.
+ */
+static int reserve_zones(struct super_block * sb, struct m_inode * inode,
+	int block, int nr)
+{
+	struct buffer_head * bh;
+	int i, n, bit;
+
+	for (i = 0 ; i < NR_PREALLOC ; i++)
+		if (!prealloc_table[i] || !prealloc_table[i]->i_prealloc_count)
+			break;
+	if (i >= NR_PREALLOC)
+		return 0;
+	bit = block - (sb->s_firstdatazone-1);
+	for (n = 0 ; n < nr ; n++,bit++) {
+		if (bit <= 0 || bit >= sb->s_nzones-sb->s_firstdatazone+1)
+			break;
+		if (!(bh = sb->s_zmap[bit>>13]) || test_bit(bit&8191,bh->b_data))
+			break;
+		if (reserved(sb->s_dev,block+n))
+			break;
+	}
+	if (n) {
+		prealloc_table[i] = inode;
+		inode->i_prealloc = block;
+		inode->i_prealloc_count = n;
+		nr_prealloc += n;
+	}
+	return n;
+}
+
+/*
+ * Allocate a zone for 'inode', as new_block() does. A file that is being
+ * extended in order gets the PREALLOC_ZONES zones after the new one
+ * reserved for it as well, and its next blocks come from those: so they
+ * end up contiguous even with several files growing at the same time.
+ */
+int new_file_block(struct m_inode * inode, int goal, int extend)
+{
+	struct super_block * sb;
+	struct buffer_head * bh;
+	int block, bit;
+
+	if (!(sb = get_super(inode->i_dev)))
+		panic("new_file_block: nonexistent device");
+	if (inode->i_prealloc_count && goal == inode->i_prealloc) {
+		bit = goal - (sb->s_firstdatazone-1);
+		bh = sb->s_zmap[bit>>13];
+		if (!set_bit(bit&8191,bh->b_data)) {
+			bh->b_dirt = 1;
+			inode->i_prealloc++;
+			if (!--inode->i_prealloc_count)
+				discard_prealloc(inode);
+			nr_zone_allocs++;
+			nr_goal_hits++;
+			clear_zone(inode->i_dev,goal);
+			return goal;
+		}
+	}
+	if (inode->i_prealloc_count)
+		discard_prealloc(inode);
+	if (!(block = new_block(inode->i_dev,goal)))
+		return 0;
+	if (extend && !inode->i_prealloc_count)
+		reserve_zones(sb,inode,block+1,PREALLOC_ZONES);
+	return block;
+}
+
 void free_inode(struct m_inode * inode)
 {
 	struct super_block * sb;
@@ -112,7 +297,7 @@ void free_inode(struct m_inode * inode)
 	if (!inode)
 		return;
 	if (!inode->i_dev) {
-		memset(inode,0,sizeof(*inode));
+		clear_inode(inode);
 		return;
 	}
 	if (inode->i_count>1) {
@@ -130,7 +315,9 @@ void free_inode(struct m_inode * inode)
 	if (clear_bit(inode->i_num&8191,bh->b_data))
 		printk("free_inode: bit already cleared.\n\r");
 	bh->b_dirt = 1;
-	memset(inode,0,sizeof(*inode));
+	if (inode->i_num < sb->s_icursor)
+		sb->s_icursor = inode->i_num;
+	clear_inode(inode);
 }
 
 struct m_inode * new_inode(int dev)
@@ -138,31 +325,38 @@ struct m_inode * new_inode(int dev)
 	struct m_inode * inode;
 	struct super_block * sb;
 	struct buffer_head * bh;
-	int i,j;
+	int j;
 
 	if (!(inode=get_empty_inode()))
 		return NULL;
 	if (!(sb = get_super(dev)))
 		panic("new_inode with unknown device");
-	j = 8192;
-	for (i=0 ; i<8 ; i++)
-		if ((bh=sb->s_imap[i]))
-			if ((j=find_first_zero(bh->b_data))<8192)
-				break;
-	if (!bh || j >= 8192 || j+i*8192 > sb->s_ninodes) {
+	if ((j = find_zero(sb->s_imap,sb->s_ninodes+1,sb->s_icursor)) < 0) {
 		iput(inode);
 		return NULL;
 	}
-	if (set_bit(j,bh->b_data))
+	bh = sb->s_imap[j>>13];
+	if (set_bit(j&8191,bh->b_data))
 		panic("new_inode: bit already set");
 	bh->b_dirt = 1;
+	sb->s_icursor = j+1;
+	nr_inode_allocs++;
 	inode->i_count=1;
 	inode->i_nlinks=1;
 	inode->i_dev=dev;
 	inode->i_uid=current->euid;
 	inode->i_gid=current->egid;
 	inode->i_dirt=1;
-	inode->i_num = j + i*8192;
+	inode->i_num = j;
+	insert_inode_hash(inode);
 	inode->i_mtime = inode->i_atime = inode->i_ctime = CURRENT_TIME;
 	return inode;
 }
+
+void show_bitmap_stat(void)
+{
+	printk("bitmaps: %d zones (%d at goal), %d inodes, %d words scanned\n\r",
+		nr_zone_allocs,nr_goal_hits,nr_inode_allocs,nr_words_scanned);
+	printk("preallocation: %d zones reserved, %d given back\n\r",
+		nr_prealloc,nr_prealloc_wasted);
+}
@@ -25,11 +25,13 @@
  */
 
 #include <stdarg.h>
+#include <errno.h>
  
 #include <linux/config.h>
 #include <linux/sched.h>
 #include <linux/kernel.h>
 #include <asm/system.h>
+#include <asm/segment.h>
 #include <asm/io.h>
 
 extern int end;
@@ -37,10 +39,32 @@ extern void put_super(int);
 extern void invalidate_inodes(int);
 
 struct buffer_head * start_buffer = (struct buffer_head *) &end;
-struct buffer_head * hash_table[NR_HASH];
-static struct buffer_head * free_list;
+struct buffer_head ** hash_table;
+static struct buffer_head * lru_list[NR_LIST] = {NULL,};
+static int nr_buffers_type[NR_LIST] = {0,};
 static struct task_struct * buffer_wait = NULL;
 int NR_BUFFERS = 0;
+int NR_HASH = 0;
+static int hash_shift = 32;
+static unsigned long nr_lookups = 0, nr_probes = 0;
+
+/*
+ * bdflush tunables, see sys_bdflush(): wakeup interval, how long a
+ * buffer may stay dirty, the percentage of dirty buffers that wakes
+ * bdflush early, and the most buffers written per pass.
+ */
+#define N_PARAM 4
+static long bdf_prm[N_PARAM] = {5*HZ, 30*HZ, 60, 64};
+static long bdf_min[N_PARAM] = {HZ/10, 0, 1, 1};
+static long bdf_max[N_PARAM] = {600*HZ, 600*HZ, 100, 1000};
+#define bdf_interval	bdf_prm[0]
+#define bdf_age		bdf_prm[1]
+#define bdf_nfract	bdf_prm[2]
+#define bdf_ndirty	bdf_prm[3]
+
+static struct task_struct * bdflush_task = NULL;
+static struct task_struct * bdflush_wait = NULL;
+static struct task_struct * bdflush_done = NULL;
 
 static inline void wait_on_buffer(struct buffer_head * bh)
 {
@@ -50,17 +74,22 @@ static inline void wait_on_buffer(struct buffer_head * bh)
 	sti();
 }
 
+static inline void refile_buffer(struct buffer_head * bh);
+
 int sys_sync(void)
 {
 	int i;
 	struct buffer_head * bh;
 
+	sync_mappings(NULL);	/* and shared mappings into buffers */
 	sync_inodes();		/* write out inodes into buffers */
 	bh = start_buffer;
 	for (i=0 ; i<NR_BUFFERS ; i++,bh++) {
 		wait_on_buffer(bh);
-		if (bh->b_dirt)
+		if (bh->b_dirt) {
 			ll_rw_block(WRITE,bh);
+			refile_buffer(bh);
+		}
 	}
 	return 0;
 }
@@ -75,8 +104,10 @@ int sync_dev(int dev)
 		if (bh->b_dev != dev)
 			continue;
 		wait_on_buffer(bh);
-		if (bh->b_dev == dev && bh->b_dirt)
+		if (bh->b_dev == dev && bh->b_dirt) {
 			ll_rw_block(WRITE,bh);
+			refile_buffer(bh);
+		}
 	}
 	sync_inodes();
 	bh = start_buffer;
@@ -84,13 +115,15 @@ int sync_dev(int dev)
 		if (bh->b_dev != dev)
 			continue;
 		wait_on_buffer(bh);
-		if (bh->b_dev == dev && bh->b_dirt)
+		if (bh->b_dev == dev && bh->b_dirt) {
 			ll_rw_block(WRITE,bh);
+			refile_buffer(bh);
+		}
 	}
 	return 0;
 }
 
-void inline invalidate_buffers(int dev)
+void invalidate_buffers(int dev)
 {
 	int i;
 	struct buffer_head * bh;
@@ -100,8 +133,10 @@ void inline invalidate_buffers(int dev)
 		if (bh->b_dev != dev)
 			continue;
 		wait_on_buffer(bh);
-		if (bh->b_dev == dev)
+		if (bh->b_dev == dev) {
 			bh->b_uptodate = bh->b_dirt = 0;
+			refile_buffer(bh);
+		}
 	}
 }
 
@@ -132,53 +167,112 @@ void check_disk_change(int dev)
 			put_super(super_block[i].s_dev);
 	invalidate_inodes(dev);
 	invalidate_buffers(dev);
+	invalidate_dev_pages(dev);
+	dcache_invalidate(dev,0);
 }
 
-#define _hashfn(dev,block) (((unsigned)(dev^block))%NR_HASH)
+/*
+ * NR_HASH is a power of two chosen in buffer_init(). Multiplying by
+ * 2^32/phi and keeping the top bits spreads runs of consecutive blocks
+ * over the whole table, which a plain modulus of dev^block did not.
+ */
+#define _hashfn(dev,block) \
+((((unsigned)(dev)<<16 ^ (unsigned)(block)) * 0x9E3779B1U) >> hash_shift)
 #define hash(dev,block) hash_table[_hashfn(dev,block)]
 
-static inline void remove_from_queues(struct buffer_head * bh)
+static inline void remove_from_hash(struct buffer_head * bh)
 {
-/* remove from hash-queue */
 	if (bh->b_next)
 		bh->b_next->b_prev = bh->b_prev;
 	if (bh->b_prev)
 		bh->b_prev->b_next = bh->b_next;
 	if (hash(bh->b_dev,bh->b_blocknr) == bh)
 		hash(bh->b_dev,bh->b_blocknr) = bh->b_next;
-/* remove from free list */
-	if (!(bh->b_prev_free) || !(bh->b_next_free))
-		panic("Free block list corrupted");
-	bh->b_prev_free->b_next_free = bh->b_next_free;
-	bh->b_next_free->b_prev_free = bh->b_prev_free;
-	if (free_list == bh)
-		free_list = bh->b_next_free;
+	bh->b_next = bh->b_prev = NULL;
 }
 
-static inline void insert_into_queues(struct buffer_head * bh)
+static inline void insert_into_hash(struct buffer_head * bh)
 {
-/* put at end of free list */
-	bh->b_next_free = free_list;
-	bh->b_prev_free = free_list->b_prev_free;
-	free_list->b_prev_free->b_next_free = bh;
-	free_list->b_prev_free = bh;
-/* put the buffer in new hash-queue if it has a device */
 	bh->b_prev = NULL;
 	bh->b_next = NULL;
 	if (!bh->b_dev)
 		return;
 	bh->b_next = hash(bh->b_dev,bh->b_blocknr);
 	hash(bh->b_dev,bh->b_blocknr) = bh;
-	bh->b_next->b_prev = bh;
+	if (bh->b_next)
+		bh->b_next->b_prev = bh;
+}
+
+/*
+ * The lru lists are circular, and lru_list[n] points at the oldest
+ * entry. A buffer is on a list exactly when b_next_free is set.
+ */
+static inline void remove_from_lru(struct buffer_head * bh)
+{
+	if (!bh->b_next_free)
+		return;
+	if (!bh->b_prev_free)
+		panic("Free block list corrupted");
+	if (bh->b_next_free == bh)
+		lru_list[bh->b_list] = NULL;
+	else {
+		bh->b_prev_free->b_next_free = bh->b_next_free;
+		bh->b_next_free->b_prev_free = bh->b_prev_free;
+		if (lru_list[bh->b_list] == bh)
+			lru_list[bh->b_list] = bh->b_next_free;
+	}
+	bh->b_next_free = bh->b_prev_free = NULL;
+	nr_buffers_type[bh->b_list]--;
+}
+
+#define BUF_LIST(bh) ((bh)->b_lock ? BUF_LOCKED : \
+	((bh)->b_dirt ? BUF_DIRTY : BUF_CLEAN))
+
+static inline void put_last_lru(struct buffer_head * bh)
+{
+	struct buffer_head ** head;
+
+	bh->b_list = BUF_LIST(bh);
+	if (bh->b_list != BUF_DIRTY)
+		bh->b_flushtime = 0;
+	else if (!bh->b_flushtime)
+		bh->b_flushtime = jiffies + bdf_age;
+	head = lru_list + bh->b_list;
+	if (!*head) {
+		*head = bh;
+		bh->b_prev_free = bh;
+	}
+	bh->b_next_free = *head;
+	bh->b_prev_free = (*head)->b_prev_free;
+	(*head)->b_prev_free->b_next_free = bh;
+	(*head)->b_prev_free = bh;
+	nr_buffers_type[bh->b_list]++;
+}
+
+/*
+ * Move an unused buffer to the list matching its current state. Buffers
+ * that are in use are left alone: brelse() files them when they go free.
+ */
+static inline void refile_buffer(struct buffer_head * bh)
+{
+	if (bh->b_count || !bh->b_next_free)
+		return;
+	if (bh->b_list == BUF_LIST(bh))
+		return;
+	remove_from_lru(bh);
+	put_last_lru(bh);
 }
 
 static struct buffer_head * find_buffer(int dev, int block)
 {		
 	struct buffer_head * tmp;
 
-	for (tmp = hash(dev,block) ; tmp != NULL ; tmp = tmp->b_next)
+	nr_lookups++;
+	for (tmp = hash(dev,block) ; tmp != NULL ; tmp = tmp->b_next) {
+		nr_probes++;
 		if (tmp->b_dev==dev && tmp->b_blocknr==block)
 			return tmp;
+	}
 	return NULL;
 }
 
@@ -196,69 +290,146 @@ struct buffer_head * get_hash_table(int dev, int block)
 	for (;;) {
 		if (!(bh=find_buffer(dev,block)))
 			return NULL;
-		bh->b_count++;
+		if (!bh->b_count++)
+			remove_from_lru(bh);
 		wait_on_buffer(bh);
 		if (bh->b_dev == dev && bh->b_blocknr == block)
 			return bh;
-		bh->b_count--;
+		if (!--bh->b_count)
+			put_last_lru(bh);
 	}
 }
 
+static struct buffer_head * get_free_buffer(void)
+{
+	struct buffer_head * bh;
+	int n;
+
+	for (;;) {
+		while ((bh = lru_list[BUF_CLEAN])) {
+			if (bh->b_list == BUF_LIST(bh))
+				return bh;
+			refile_buffer(bh);
+		}
+/* only interrupts unlock buffers, so the locked list can be stale */
+		if (!(bh = lru_list[BUF_LOCKED]))
+			return NULL;
+		n = nr_buffers_type[BUF_LOCKED];
+		while (n-- > 0) {
+			bh = lru_list[BUF_LOCKED];
+			if (bh->b_lock) {
+				lru_list[BUF_LOCKED] = bh->b_next_free;
+				continue;
+			}
+			refile_buffer(bh);
+		}
+		if (!lru_list[BUF_CLEAN])
+			return NULL;
+	}
+}
+
+#define too_many_dirty() \
+(nr_buffers_type[BUF_DIRTY]*100 > bdf_nfract*NR_BUFFERS)
+
+/*
+ * Nothing clean is left. Wait for a buffer that is being written, or
+ * get bdflush to write some. Only before bdflush is running, or in
+ * bdflush itself (sync_inodes() reads inode blocks), do we start the
+ * writes ourselves.
+ */
+#define NR_WRITEOUT 16
+static void wait_for_free_buffer(void)
+{
+	struct buffer_head * bh;
+	int n;
+
+	if ((bh = lru_list[BUF_LOCKED])) {
+		wait_on_buffer(bh);
+		return;
+	}
+	if (!lru_list[BUF_DIRTY]) {
+		sleep_on(&buffer_wait);
+		return;
+	}
+	if (bdflush_task && bdflush_task != current) {
+		wake_up(&bdflush_wait);
+		sleep_on(&bdflush_done);
+		return;
+	}
+	for (n = 0 ; n < NR_WRITEOUT ; n++) {
+		if (!(bh = lru_list[BUF_DIRTY]))
+			break;
+		if (!bh->b_dirt) {
+			refile_buffer(bh);
+			continue;
+		}
+		ll_rw_block(WRITE,bh);
+		refile_buffer(bh);
+	}
+	if ((bh = lru_list[BUF_LOCKED]))
+		wait_on_buffer(bh);
+}
+
 /*
  * Ok, this is getblk, and it isn't very clear, again to hinder
  * race-conditions. Most of the code is seldom used, (ie repeating),
  * so it should be much more efficient than it looks.
  *
  * The algoritm is changed: hopefully better, and an elusive bug removed.
+ *
+ * Free buffers are taken off the head of the clean lru list, so a miss
+ * costs the same however many buffers we have.
  */
 /*
  * getblk 是缓冲区搜索管理函数，用于在所有缓冲块中寻找最为空闲的缓冲块
  */
-#define BADNESS(bh) (((bh)->b_dirt<<1)+(bh)->b_lock)
 struct buffer_head * getblk(int dev,int block)
 {
-	struct buffer_head * tmp, * bh;
+	struct buffer_head * bh;
 
 repeat:
 	if ((bh = get_hash_table(dev,block)))
 		return bh;
-	tmp = free_list;
-	do {
-		if (tmp->b_count)
-			continue;
-		if (!bh || BADNESS(tmp)<BADNESS(bh)) {
-			bh = tmp;
-			if (!BADNESS(tmp))
-				break;
-		}
-/* and repeat until we find something good */
-	} while ((tmp = tmp->b_next_free) != free_list);
-	if (!bh) {
-		sleep_on(&buffer_wait);
+	if (!(bh = get_free_buffer())) {
+		wait_for_free_buffer();
 		goto repeat;
 	}
-	wait_on_buffer(bh);
-	if (bh->b_count)
-		goto repeat;
-	while (bh->b_dirt) {
-		sync_dev(bh->b_dev);
-		wait_on_buffer(bh);
-		if (bh->b_count)
-			goto repeat;
-	}
-/* NOTE!! While we slept waiting for this block, somebody else might */
-/* already have added "this" block to the cache. check it */
-	if (find_buffer(dev,block))
-		goto repeat;
-/* OK, FINALLY we know that this buffer is the only one of it's kind, */
-/* and that it's unused (b_count=0), unlocked (b_lock=0), and clean */
+/* get_free_buffer() doesn't sleep, so nobody can have added "this" */
+/* block to the cache since get_hash_table() failed to find it. */
+	remove_from_lru(bh);
+	remove_from_hash(bh);
 	bh->b_count=1;
 	bh->b_dirt=0;
 	bh->b_uptodate=0;
-	remove_from_queues(bh);
 	bh->b_dev=dev;
 	bh->b_blocknr=block;
-	insert_into_queues(bh);
+	insert_into_hash(bh);
+	return bh;
+}
+
+/*
+ * Fill the buffer of 'block' with BLOCK_SIZE bytes from user space at
+ * 'buf', for a write that covers it as a whole: it isn't read first.
+ * Until it has been filled, the buffer isn't marked uptodate, so what
+ * it held before (which can be some other block) is never taken for
+ * this block's. The copy can sleep on a page fault, and a read of the
+ * block meanwhile overwrites it: it is then done again.
+ */
+struct buffer_head * overwrite_block(int dev, int block, const char * buf)
+{
+	struct buffer_head * bh;
+
+	if (!(bh = getblk(dev,block)))
+		return NULL;
+	wait_on_buffer(bh);
+	if (!bh->b_uptodate) {
+		copy_from_user(bh->b_data,buf,BLOCK_SIZE);
+		wait_on_buffer(bh);
+	}
+	if (bh->b_uptodate)
+		copy_from_user(bh->b_data,buf,BLOCK_SIZE);
+	bh->b_uptodate = 1;
+	bh->b_dirt = 1;
 	return bh;
 }
 
@@ -269,7 +440,11 @@ void brelse(struct buffer_head * buf)
 	wait_on_buffer(buf);
 	if (!(buf->b_count--))
 		panic("Trying to free free buffer");
+	if (!buf->b_count)
+		put_last_lru(buf);
 	wake_up(&buffer_wait);
+	if (buf->b_dirt && too_many_dirty())
+		wake_up(&bdflush_wait);
 }
 
 /*
@@ -306,11 +481,19 @@ __asm__("cld\n\t" \
 	::"c" (BLOCK_SIZE/4),"S" (from),"D" (to) \
 	)
 
+#define ZEROBLK(to) \
+__asm__("cld\n\t" \
+	"rep\n\t" \
+	"stosl\n\t" \
+	::"a" (0),"c" (BLOCK_SIZE/4),"D" (to) \
+	)
+
 /*
  * bread_page reads four buffers into memory at the desired address. It's
  * a function of its own, as there is some speed to be got by reading them
  * all at the same time, not waiting for one to be read, and then another
- * etc.
+ * etc. Holes, and blocks that fail to read, are cleared, so the page may
+ * come from get_dirty_page().
  */
 /*
  * 页块读取函数，一次性读取一页内存所能容纳的缓冲块数（4块）
@@ -332,8 +515,27 @@ void bread_page(unsigned long address,int dev,int b[4])
 			wait_on_buffer(bh[i]);
 			if (bh[i]->b_uptodate)
 				COPYBLK((unsigned long) bh[i]->b_data,address);
+			else
+				ZEROBLK(address);
 			brelse(bh[i]);
-		}
+		} else
+			ZEROBLK(address);
+}
+
+/*
+ * Start reading a block that will probably be wanted soon, without
+ * waiting for it.
+ */
+void reada_block(int dev,int block)
+{
+	struct buffer_head * bh;
+
+	if (!(bh=getblk(dev,block)))
+		panic("reada_block: getblk returned NULL\n");
+	if (!bh->b_uptodate)
+		ll_rw_block(READA,bh);
+	if (!--bh->b_count)
+		put_last_lru(bh);
 }
 
 /*
@@ -344,21 +546,15 @@ void bread_page(unsigned long address,int dev,int b[4])
 struct buffer_head * breada(int dev,int first, ...)
 {
 	va_list args;
-	struct buffer_head * bh, *tmp;
+	struct buffer_head * bh;
 
 	va_start(args,first);
 	if (!(bh=getblk(dev,first)))
 		panic("bread: getblk returned NULL\n");
 	if (!bh->b_uptodate)
 		ll_rw_block(READ,bh);
-	while ((first=va_arg(args,int))>=0) {
-		tmp=getblk(dev,first);
-		if (tmp) {
-			if (!tmp->b_uptodate)
-				ll_rw_block(READA,bh);
-			tmp->b_count--;
-		}
-	}
+	while ((first=va_arg(args,int))>=0)
+		reada_block(dev,first);
 	va_end(args);
 	wait_on_buffer(bh);
 	if (bh->b_uptodate)
@@ -367,6 +563,105 @@ struct buffer_head * breada(int dev,int first, ...)
 	return (NULL);
 }
 
+/*
+ * Start writing the dirty buffers whose time has come, oldest first,
+ * or simply the oldest ones if 'force' is set. Normally this is done
+ * with WRITEA, which gives up when the request queue is full, and so do
+ * we. When buffers are short we use WRITE and wait for the queue.
+ */
+static void flush_dirty_buffers(int force)
+{
+	struct buffer_head * bh;
+	int n = nr_buffers_type[BUF_DIRTY];
+	int nr = bdf_ndirty;
+
+	while (n-- > 0 && (bh = lru_list[BUF_DIRTY])) {
+		if (!bh->b_dirt || bh->b_lock) {
+			refile_buffer(bh);
+			continue;
+		}
+/* the list is in dirtying order, so the rest aren't due either */
+		if (!force && jiffies - bh->b_flushtime < 0)
+			break;
+		ll_rw_block(force ? WRITE : WRITEA,bh);
+		if (bh->b_dirt)
+			break;
+		refile_buffer(bh);
+		if (!--nr)
+			break;
+	}
+}
+
+static int bdflush_timer = 0;
+
+static void bdflush_timeout(void)
+{
+	bdflush_timer = 0;
+	wake_up(&bdflush_wait);
+}
+
+/*
+ * This is the body of the bdflush daemon: a process that init forks
+ * early on, which then never comes back out of the system call. It
+ * keeps the writing of dirty buffers away from getblk().
+ */
+static int bdflush(void)
+{
+	if (bdflush_task)
+		return -EBUSY;
+	bdflush_task = current;
+	for (;;) {
+/* mapped pages are looked at each interval, not on every wakeup */
+		if (!bdflush_timer)
+			sync_mappings(NULL);
+		sync_inodes();
+		flush_dirty_buffers(too_many_dirty() || !lru_list[BUF_CLEAN]);
+		wake_up(&bdflush_done);
+		if (!bdflush_timer) {
+			bdflush_timer = 1;
+			add_timer(bdf_interval,bdflush_timeout);
+		}
+		interruptible_sleep_on(&bdflush_wait);
+		if (current->signal & ~current->blocked)
+			break;
+	}
+	bdflush_task = NULL;
+	wake_up(&bdflush_done);
+	return -EINTR;
+}
+
+/*
+ * func 0 turns the caller into bdflush, func 1 flushes aged buffers
+ * right away. func 2*n+2 reads tunable n into *data, 2*n+3 sets it to
+ * 'data'.
+ */
+int sys_bdflush(int func, long data)
+{
+	int i;
+
+	if (!suser())
+		return -EPERM;
+	if (func == 0)
+		return bdflush();
+	if (func == 1) {
+		sync_inodes();
+		flush_dirty_buffers(0);
+		return 0;
+	}
+	i = (func-2) >> 1;
+	if (i < 0 || i >= N_PARAM)
+		return -EINVAL;
+	if (!(func & 1)) {
+		verify_area((void *) data,4);
+		put_fs_long(bdf_prm[i],(unsigned long *) data);
+		return 0;
+	}
+	if (data < bdf_min[i] || data > bdf_max[i])
+		return -EINVAL;
+	bdf_prm[i] = data;
+	return 0;
+}
+
 void buffer_init(long buffer_end)
 {
 	struct buffer_head * h = start_buffer;
@@ -377,6 +672,14 @@ void buffer_init(long buffer_end)
 		b = (void *) (640*1024);
 	else
 		b = (void *) buffer_end;
+/* about one hash chain per buffer, the table taken from the top */
+	i = ((char *) b - (char *) start_buffer) /
+		(BLOCK_SIZE + sizeof(struct buffer_head));
+	for (NR_HASH = 64, hash_shift = 26 ; NR_HASH < i ; NR_HASH <<= 1)
+		hash_shift--;
+	b -= NR_HASH * sizeof(struct buffer_head *);
+	hash_table = (struct buffer_head **) b;
+	b = (void *) ((long) b & ~(BLOCK_SIZE-1));
 	while ( (b -= BLOCK_SIZE) >= ((void *) (h+1)) ) {
 		h->b_dev = 0;
 		h->b_dirt = 0;
@@ -387,17 +690,41 @@ void buffer_init(long buffer_end)
 		h->b_next = NULL;
 		h->b_prev = NULL;
 		h->b_data = (char *) b;
-		h->b_prev_free = h-1;
-		h->b_next_free = h+1;
+		h->b_next_free = NULL;
+		h->b_prev_free = NULL;
+		h->b_reqnext = NULL;
+		h->b_flushtime = 0;
+		put_last_lru(h);
 		h++;
 		NR_BUFFERS++;
 		if (b == (void *) 0x100000)
 			b = (void *) 0xA0000;
 	}
-	h--;
-	free_list = start_buffer;
-	free_list->b_prev_free = h;
-	h->b_next_free = free_list;
 	for (i=0;i<NR_HASH;i++)
 		hash_table[i]=NULL;
-}	
+}
+
+void show_buffer_stat(void)
+{
+	struct buffer_head * bh;
+	int i, n, used = 0, longest = 0;
+
+	for (i=0 ; i<NR_HASH ; i++) {
+		for (n=0,bh=hash_table[i] ; bh ; bh=bh->b_next)
+			n++;
+		if (n)
+			used++;
+		if (n > longest)
+			longest = n;
+	}
+	printk("buffers: %d (%d clean, %d locked, %d dirty)\n\r",NR_BUFFERS,
+		nr_buffers_type[BUF_CLEAN],nr_buffers_type[BUF_LOCKED],
+		nr_buffers_type[BUF_DIRTY]);
+	printk("buffer hash: %d chains, %d used, longest %d, ",
+		NR_HASH,used,longest);
+	if (nr_lookups)
+		printk("%d.%02d probes/lookup\n\r",nr_probes/nr_lookups,
+			(nr_probes%nr_lookups)*100/nr_lookups);
+	else
+		printk("no lookups\n\r");
+}
@@ -0,0 +1,194 @@
+/*
+ *  linux/fs/dcache.c
+ */
+
+/*
+ * The name cache remembers what path components were found to be, so
+ * that namei() and friends need not read the directory again: it maps
+ * (device, directory inode, name) to an inode number, or to 0 for names
+ * that were looked for and are not there. namei.c keeps it up to date
+ * whenever it changes a directory.
+ *
+ * Entries are hashed, and kept on a circular lru list that dcache_add()
+ * takes the oldest entry from. Unused entries sit at the head.
+ *
+ * Reading a directory can sleep, and the directory can change
+ * meanwhile. dcache_version goes up whenever something is forgotten, so
+ * a lookup that saw it change knows not to add what it found.
+ */
+#include <string.h>
+
+#include <linux/sched.h>
+#include <linux/kernel.h>
+
+#define NR_DCACHE 256
+#define NR_DCACHE_HASH 64		/* must be a power of two */
+
+struct dir_cache_entry {
+	unsigned short dev;		/* 0 if unused */
+	unsigned short dir;
+	unsigned short ino;		/* 0 for a name that isn't there */
+	unsigned char len;
+	char name[NAME_LEN];
+	struct dir_cache_entry * next, * prev;		/* hash chain */
+	struct dir_cache_entry * lru_next, * lru_prev;
+};
+
+static struct dir_cache_entry dcache[NR_DCACHE];
+static struct dir_cache_entry * dcache_hash[NR_DCACHE_HASH];
+static struct dir_cache_entry * dcache_lru = NULL;
+static long nr_dlookups = 0, nr_dhits = 0;
+unsigned long dcache_version = 0;
+
+static inline unsigned int dcache_hashfn(int dev, int dir,
+	const char * name, int len)
+{
+	unsigned int h = (dev << 16) ^ dir;
+
+	while (len--)
+		h = h * 31 + (unsigned char) *name++;
+	return (h * 0x9E3779B1U) >> 26;
+}
+
+static void remove_from_lru(struct dir_cache_entry * de)
+{
+	if (de->lru_next == de)
+		dcache_lru = NULL;
+	else {
+		de->lru_prev->lru_next = de->lru_next;
+		de->lru_next->lru_prev = de->lru_prev;
+		if (dcache_lru == de)
+			dcache_lru = de->lru_next;
+	}
+}
+
+/* put an entry at the tail of the lru list, or at its head if unused */
+static void put_lru(struct dir_cache_entry * de)
+{
+	if (!dcache_lru) {
+		dcache_lru = de;
+		de->lru_prev = de;
+	}
+	de->lru_next = dcache_lru;
+	de->lru_prev = dcache_lru->lru_prev;
+	dcache_lru->lru_prev->lru_next = de;
+	dcache_lru->lru_prev = de;
+	if (!de->dev)
+		dcache_lru = de;
+}
+
+static void remove_from_hash(struct dir_cache_entry * de)
+{
+	if (!de->dev)
+		return;
+	if (de->next)
+		de->next->prev = de->prev;
+	if (de->prev)
+		de->prev->next = de->next;
+	else
+		dcache_hash[dcache_hashfn(de->dev,de->dir,de->name,de->len)] =
+			de->next;
+	de->next = de->prev = NULL;
+}
+
+static void drop_entry(struct dir_cache_entry * de)
+{
+	remove_from_hash(de);
+	de->dev = 0;
+	remove_from_lru(de);
+	put_lru(de);
+}
+
+static struct dir_cache_entry * find_dentry(struct m_inode * dir,
+	const char * name, int len)
+{
+	struct dir_cache_entry * de;
+
+	de = dcache_hash[dcache_hashfn(dir->i_dev,dir->i_num,name,len)];
+	for ( ; de ; de = de->next)
+		if (de->dir == dir->i_num && de->dev == dir->i_dev &&
+		    de->len == len && !memcmp(de->name,name,len))
+			return de;
+	return NULL;
+}
+
+/*
+ * Look up 'name' (in kernel space) in 'dir'. Returns 1 and sets *ino,
+ * which is 0 if the name is known not to exist, if it is cached.
+ */
+int dcache_lookup(struct m_inode * dir, const char * name, int len, int * ino)
+{
+	struct dir_cache_entry * de;
+
+	nr_dlookups++;
+	if (len > NAME_LEN || !(de = find_dentry(dir,name,len)))
+		return 0;
+	remove_from_lru(de);
+	put_lru(de);
+	*ino = de->ino;
+	nr_dhits++;
+	return 1;
+}
+
+void dcache_add(struct m_inode * dir, const char * name, int len, int ino)
+{
+	struct dir_cache_entry * de;
+	unsigned int h;
+
+	if (len > NAME_LEN || !dir->i_dev)
+		return;
+	if (!(de = find_dentry(dir,name,len))) {
+		de = dcache_lru;
+		remove_from_hash(de);
+		de->dev = dir->i_dev;
+		de->dir = dir->i_num;
+		de->len = len;
+		memcpy(de->name,name,len);
+		h = dcache_hashfn(de->dev,de->dir,name,len);
+		de->prev = NULL;
+		if ((de->next = dcache_hash[h]))
+			de->next->prev = de;
+		dcache_hash[h] = de;
+	}
+	de->ino = ino;
+	remove_from_lru(de);
+	put_lru(de);
+}
+
+/* forget what we knew about 'name' in 'dir' */
+void dcache_forget(struct m_inode * dir, const char * name, int len)
+{
+	struct dir_cache_entry * de;
+
+	dcache_version++;
+	if (len <= NAME_LEN && (de = find_dentry(dir,name,len)))
+		drop_entry(de);
+}
+
+/*
+ * Forget all names in directory 'dir' of 'dev', as when it is removed,
+ * or everything about 'dev' if 'dir' is 0.
+ */
+void dcache_invalidate(int dev, int dir)
+{
+	int i;
+
+	dcache_version++;
+	for (i = 0 ; i < NR_DCACHE ; i++)
+		if (dcache[i].dev == dev && (!dir || dcache[i].dir == dir))
+			drop_entry(dcache + i);
+}
+
+void dcache_init(void)
+{
+	int i;
+
+	for (i = 0 ; i < NR_DCACHE ; i++)
+		put_lru(dcache + i);
+}
+
+void show_dcache_stat(void)
+{
+	printk("name cache: %d entries, %d lookups, %d hits\n\r",
+		NR_DCACHE,nr_dlookups,nr_dhits);
+}
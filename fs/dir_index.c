@@ -0,0 +1,542 @@
+/*
+ *  linux/fs/dir_index.c
+ */
+
+/*
+ * Hashed indexes for large directories. The directory itself stays an
+ * ordinary array of dir_entries, so a kernel that knows nothing of this
+ * still reads and changes it correctly. The index is a regular file,
+ * named INDEX_NAME in entry INDEX_SLOT of the directory (the first after
+ * "." and ".."), holding an open-addressed hash table of entry numbers.
+ * Only a root-owned file with the reserved mode I_DIRINDEX is taken for
+ * an index: user space can't make one, nor open, change or link to it.
+ * Anything else in that entry is moved out of the way when the index
+ * is made.
+ *
+ * Every index lookup is checked against the entry it leads to, so an
+ * index that still has entries the directory lost does no harm. One
+ * that lacks some would make names vanish, so a miss is only believed
+ * if the index has been built by this kernel since the directory was
+ * read in (i_index_ok), with every change to the directory since made
+ * through it. Otherwise find_entry() reads the directory through, and
+ * the index is built again by the next add_entry(): a lookup never
+ * writes.
+ *
+ * Directories get an index once they reach INDEX_MIN_SIZE bytes. Index
+ * operations sleep, so those on one directory are done one at a time.
+ */
+#include <string.h>
+#include <const.h>
+#include <sys/stat.h>
+
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <asm/system.h>
+
+#define INDEX_NAME ".dirhash"
+#define INDEX_SLOT 2
+#define INDEX_MAGIC 0x1dc5
+#define INDEX_MIN_SIZE (4*BLOCK_SIZE)
+#define CELLS_PER_BLOCK (BLOCK_SIZE/sizeof(unsigned short))
+#define MIN_CELLS 1024
+#define MAX_ENTRIES 0xfffe
+
+/* cells hold an entry number plus one, or one of these */
+#define EMPTY 0
+#define DELETED 0xffff
+
+struct index_header {
+	unsigned short magic;
+	unsigned short unused;
+	unsigned long mtime;	/* of the directory the last time */
+	unsigned long size;	/* the index was known to be right */
+	unsigned long cells;	/* a power of two, in blocks 1 on */
+	unsigned long used;	/* cells that aren't EMPTY */
+	unsigned long hint;	/* entries below this are all in use */
+};
+
+static void lock_index(struct m_inode * dir)
+{
+	cli();
+	while (dir->i_index_lock)
+		sleep_on(&dir->i_wait);
+	dir->i_index_lock = 1;
+	sti();
+}
+
+static void unlock_index(struct m_inode * dir)
+{
+	dir->i_index_lock = 0;
+	wake_up(&dir->i_wait);
+}
+
+static unsigned long name_hash(const char * name, int len)
+{
+	unsigned long h = 0;
+
+	while (len-- > 0 && *name)
+		h = h * 31 + (unsigned char) *name++;
+	return h * 0x9E3779B1U;
+}
+
+static int same_name(const char * name, int len, struct dir_entry * de)
+{
+	if (!de->inode || len > NAME_LEN)
+		return 0;
+	if (len < NAME_LEN && de->name[len])
+		return 0;
+	return !memcmp(name,de->name,len);
+}
+
+static struct buffer_head * get_entry(struct m_inode * dir, unsigned long nr,
+	struct dir_entry ** de)
+{
+	struct buffer_head * bh;
+	int block;
+
+	if (!(block = bmap(dir,nr/DIR_ENTRIES_PER_BLOCK)) ||
+	    !(bh = bread(dir->i_dev,block)))
+		return NULL;
+	*de = nr%DIR_ENTRIES_PER_BLOCK + (struct dir_entry *) bh->b_data;
+	return bh;
+}
+
+/*
+ * The cell table is read through 'bh', which is kept from one call to
+ * the next while the cells stay in the same block.
+ */
+static unsigned short * get_cell(struct m_inode * index, unsigned long nr,
+	struct buffer_head ** bh)
+{
+	int block;
+
+	block = bmap(index,1 + nr/CELLS_PER_BLOCK);
+	if (!block || !*bh || (*bh)->b_blocknr != block) {
+		brelse(*bh);
+		*bh = NULL;
+		if (!block || !(*bh = bread(index->i_dev,block)))
+			return NULL;
+	}
+	return nr%CELLS_PER_BLOCK + (unsigned short *) (*bh)->b_data;
+}
+
+static int insert_cell(struct m_inode * index, struct index_header * h,
+	const char * name, int len, unsigned long nr)
+{
+	struct buffer_head * bh = NULL;
+	unsigned long i, n;
+	unsigned short * cell;
+
+	i = name_hash(name,len);
+	for (n = 0 ; n < h->cells ; n++,i++) {
+		if (!(cell = get_cell(index,i & (h->cells-1),&bh)))
+			return 0;
+		if (*cell != EMPTY && *cell != DELETED)
+			continue;
+		if (*cell == EMPTY)
+			h->used++;
+		*cell = nr + 1;
+		bh->b_dirt = 1;
+		brelse(bh);
+		return 1;
+	}
+	brelse(bh);
+	return 0;
+}
+
+/*
+ * (Re)build the index of 'dir' from the directory, with room for it to
+ * grow to twice its size. Returns 0 if it couldn't be done, leaving the
+ * index marked invalid.
+ */
+static int build_index(struct m_inode * dir, struct m_inode * index,
+	struct buffer_head * hbh)
+{
+	struct index_header * h = (struct index_header *) hbh->b_data;
+	unsigned long entries, i;
+	struct buffer_head * bh = NULL;
+	struct dir_entry * de = NULL;
+	int block;
+
+	h->magic = 0;
+	hbh->b_dirt = 1;
+	entries = dir->i_size / sizeof (struct dir_entry);
+	if (entries > MAX_ENTRIES)
+		return 0;
+	for (h->cells = MIN_CELLS ; h->cells < 4*entries ; h->cells <<= 1)
+		/* nothing */ ;
+	for (i = 0 ; i < h->cells/CELLS_PER_BLOCK ; i++) {
+		if (!(block = create_block(index,1+i)) ||
+		    !(bh = getblk(index->i_dev,block)))
+			return 0;
+		memset(bh->b_data,0,BLOCK_SIZE);
+		bh->b_uptodate = 1;
+		bh->b_dirt = 1;
+		brelse(bh);
+	}
+	bh = NULL;
+	index->i_size = (1 + h->cells/CELLS_PER_BLOCK) * BLOCK_SIZE;
+	index->i_dirt = 1;
+	h->used = 0;
+	h->hint = entries;
+	for (i = 0 ; i < entries ; i++,de++) {
+		if (!(i % DIR_ENTRIES_PER_BLOCK)) {
+			brelse(bh);
+			if (!(bh = get_entry(dir,i,&de))) {
+				i += DIR_ENTRIES_PER_BLOCK-1;
+				continue;
+			}
+		}
+		if (!de->inode) {
+			if (i < h->hint)
+				h->hint = i;
+			continue;
+		}
+/* the index itself isn't found by name */
+		if (i == INDEX_SLOT)
+			continue;
+		if (!insert_cell(index,h,de->name,NAME_LEN,i)) {
+			brelse(bh);
+			return 0;
+		}
+	}
+	brelse(bh);
+	h->magic = INDEX_MAGIC;
+	h->mtime = dir->i_mtime;
+	h->size = dir->i_size;
+	return 1;
+}
+
+/*
+ * The first unused entry of 'dir' from 'nr' on, the directory growing
+ * by one if there is none. Returns its buffer, with the entry number in
+ * *res_nr.
+ */
+static struct buffer_head * free_entry(struct m_inode * dir, unsigned long nr,
+	unsigned long * res_nr, struct dir_entry ** de)
+{
+	struct buffer_head * bh;
+	int block;
+
+	for ( ; nr <= MAX_ENTRIES ; nr++) {
+		if (nr * sizeof (struct dir_entry) >= dir->i_size) {
+			if (!(block = create_block(dir,nr/DIR_ENTRIES_PER_BLOCK)) ||
+			    !(bh = bread(dir->i_dev,block)))
+				return NULL;
+			*de = nr%DIR_ENTRIES_PER_BLOCK +
+				(struct dir_entry *) bh->b_data;
+			(*de)->inode = 0;
+			dir->i_size = (nr+1) * sizeof (struct dir_entry);
+			dir->i_ctime = CURRENT_TIME;
+			dir->i_dirt = 1;
+			*res_nr = nr;
+			return bh;
+		}
+		if (!(bh = get_entry(dir,nr,de)))
+			continue;
+		if (!(*de)->inode) {
+			*res_nr = nr;
+			return bh;
+		}
+		brelse(bh);
+	}
+	return NULL;
+}
+
+/*
+ * The index file of 'dir', if it has one. If it can't be got at, any
+ * index the directory has may miss what is changed meanwhile.
+ */
+static struct m_inode * get_index(struct m_inode * dir)
+{
+	struct buffer_head * bh;
+	struct dir_entry * de;
+	struct m_inode * index;
+	int inr = 0;
+
+	if (dir->i_size >= INDEX_MIN_SIZE && dir->i_zone[0] &&
+	    (bh = bread(dir->i_dev,dir->i_zone[0]))) {
+		de = INDEX_SLOT + (struct dir_entry *) bh->b_data;
+		if (de->inode && !strncmp(de->name,INDEX_NAME,NAME_LEN))
+			inr = de->inode;
+		brelse(bh);
+	}
+	if (inr && (index = iget(dir->i_dev,inr))) {
+		if (IS_DIRINDEX(index) && index->i_nlinks == 1)
+			return index;
+		iput(index);
+	}
+	dir->i_index_ok = 0;
+	return NULL;
+}
+
+/*
+ * Read the index header, if the index is known to be up to date with
+ * the directory; with 'rebuild' set, one that isn't is built again. The
+ * mtime and size in the header only go to the second, and say nothing
+ * of what another system did to the directory, so an index left on disk
+ * has to be built again before it is used.
+ */
+static struct buffer_head * get_header(struct m_inode * dir,
+	struct m_inode * index, int rebuild)
+{
+	struct buffer_head * bh;
+	struct index_header * h;
+	int block;
+
+	block = rebuild ? create_block(index,0) : bmap(index,0);
+	if (!block || !(bh = bread(index->i_dev,block))) {
+		dir->i_index_ok = 0;
+		return NULL;
+	}
+	h = (struct index_header *) bh->b_data;
+	if (dir->i_index_ok && h->magic == INDEX_MAGIC &&
+	    h->mtime == dir->i_mtime && h->size == dir->i_size)
+		return bh;
+	if ((dir->i_index_ok = rebuild && build_index(dir,index,bh)))
+		return bh;
+	brelse(bh);
+	return NULL;
+}
+
+/*
+ * Give a directory that has grown large an index. The entry in
+ * INDEX_SLOT is moved out of the way first.
+ */
+static struct m_inode * make_index(struct m_inode * dir)
+{
+	struct m_inode * index;
+	struct buffer_head * bh, * bh2;
+	struct dir_entry * de, * de2;
+	unsigned long nr;
+
+	if (!(index = new_inode(dir->i_dev)))
+		return NULL;
+	index->i_mode = I_DIRINDEX;
+	index->i_uid = 0;
+	index->i_gid = 0;
+	index->i_dirt = 1;
+	if (!(bh = get_entry(dir,INDEX_SLOT,&de)))
+		goto fail;
+	if (de->inode) {
+		if (!(bh2 = free_entry(dir,INDEX_SLOT+1,&nr,&de2))) {
+			brelse(bh);
+			goto fail;
+		}
+		*de2 = *de;
+		bh2->b_dirt = 1;
+		brelse(bh2);
+	}
+	de->inode = index->i_num;
+	strncpy(de->name,INDEX_NAME,NAME_LEN);
+	bh->b_dirt = 1;
+	brelse(bh);
+	dir->i_mtime = CURRENT_TIME;
+	dir->i_dirt = 1;
+	return index;
+fail:
+	index->i_nlinks = 0;
+	iput(index);
+	return NULL;
+}
+
+/*
+ * Look 'name' (in kernel space) up in the index of 'dir'. Returns -1 if
+ * there is no up to date index to use, or it couldn't be read, else whether it was
+ * found, with the buffer and entry in *res_bh and *res_dir.
+ */
+int dir_index_find(struct m_inode * dir, const char * name, int len,
+	struct buffer_head ** res_bh, struct dir_entry ** res_dir)
+{
+	struct m_inode * index;
+	struct buffer_head * hbh, * bh = NULL, * cbh = NULL;
+	struct index_header * h;
+	struct dir_entry * de;
+	unsigned short * cell;
+	unsigned long i, n;
+	int ret = -1;
+
+	lock_index(dir);
+	if (!(index = get_index(dir))) {
+		unlock_index(dir);
+		return -1;
+	}
+	if (!(hbh = get_header(dir,index,0)))
+		goto out;
+	h = (struct index_header *) hbh->b_data;
+	ret = 0;
+	i = name_hash(name,len);
+	for (n = 0 ; n < h->cells ; n++,i++) {
+		if (!(cell = get_cell(index,i & (h->cells-1),&cbh))) {
+			ret = -1;
+			break;
+		}
+		if (*cell == EMPTY)
+			break;
+		if (*cell == DELETED || !(bh = get_entry(dir,*cell-1,&de)))
+			continue;
+		if (same_name(name,len,de)) {
+			*res_bh = bh;
+			*res_dir = de;
+			ret = 1;
+			break;
+		}
+		brelse(bh);
+	}
+	brelse(cbh);
+	brelse(hbh);
+out:
+	iput(index);
+	unlock_index(dir);
+	return ret;
+}
+
+/*
+ * Add 'name' to 'dir' through its index, as add_entry() does: the entry
+ * returned in *res_bh and *res_dir has the name and inode 0. Returns -1
+ * if the directory has no index, and isn't big enough to get one.
+ */
+int dir_index_add(struct m_inode * dir, const char * name, int len,
+	struct buffer_head ** res_bh, struct dir_entry ** res_dir)
+{
+	struct m_inode * index;
+	struct buffer_head * hbh, * bh = NULL;
+	struct index_header * h;
+	struct dir_entry * de;
+	unsigned long nr;
+	int i;
+
+	lock_index(dir);
+	if (!(index = get_index(dir))) {
+		if (dir->i_size < INDEX_MIN_SIZE || !(index = make_index(dir))) {
+			unlock_index(dir);
+			return -1;
+		}
+	}
+	if (!(hbh = get_header(dir,index,1))) {
+		iput(index);
+		unlock_index(dir);
+		return -1;
+	}
+	h = (struct index_header *) hbh->b_data;
+	if (2*(h->used+1) > h->cells &&
+	    !(dir->i_index_ok = build_index(dir,index,hbh)))
+		goto fail;
+	if (!(bh = free_entry(dir,h->hint,&nr,&de)))
+		goto fail;
+	if (!insert_cell(index,h,name,len,nr)) {
+		brelse(bh);
+		goto fail;
+	}
+	h->hint = nr+1;
+	dir->i_mtime = CURRENT_TIME;
+	dir->i_dirt = 1;
+	h->mtime = dir->i_mtime;
+	h->size = dir->i_size;
+	hbh->b_dirt = 1;
+	brelse(hbh);
+	iput(index);
+	unlock_index(dir);
+/* no sleeping from here until the caller fills in the inode */
+	for (i = 0 ; i < NAME_LEN ; i++)
+		de->name[i] = (i < len) ? name[i] : 0;
+	bh->b_dirt = 1;
+	*res_bh = bh;
+	*res_dir = de;
+	return 1;
+fail:
+	brelse(hbh);
+	iput(index);
+	unlock_index(dir);
+	return 0;
+}
+
+/*
+ * Take the entry 'de' of 'dir', which is about to be cleared, out of
+ * the index. The directory's times are updated here, so that the index
+ * stays in step with them. An index that is out of date already is left
+ * for the next dir_index_add() to build again.
+ */
+void dir_index_remove(struct m_inode * dir, struct dir_entry * de)
+{
+	struct m_inode * index;
+	struct buffer_head * hbh, * bh, * cbh = NULL;
+	struct index_header * h;
+	struct dir_entry * tmp;
+	unsigned short * cell;
+	unsigned long i, n;
+
+	lock_index(dir);
+	if (!(index = get_index(dir))) {
+		unlock_index(dir);
+		return;
+	}
+	if (!(hbh = get_header(dir,index,0)))
+		goto out;
+	h = (struct index_header *) hbh->b_data;
+	i = name_hash(de->name,NAME_LEN);
+	for (n = 0 ; n < h->cells ; n++,i++) {
+		if (!(cell = get_cell(index,i & (h->cells-1),&cbh)) ||
+		    *cell == EMPTY)
+			break;
+		if (*cell == DELETED || !(bh = get_entry(dir,*cell-1,&tmp)))
+			continue;
+		brelse(bh);
+		if (tmp != de)
+			continue;
+		if (*cell-1 < h->hint)
+			h->hint = *cell-1;
+		*cell = DELETED;
+		cbh->b_dirt = 1;
+		break;
+	}
+	brelse(cbh);
+	dir->i_mtime = dir->i_ctime = CURRENT_TIME;
+	dir->i_dirt = 1;
+	h->mtime = dir->i_mtime;
+	h->size = dir->i_size;
+	hbh->b_dirt = 1;
+	brelse(hbh);
+out:
+	iput(index);
+	unlock_index(dir);
+}
+
+/*
+ * Is entry 'nr', 'de', of 'dir' its index? rmdir() counts a directory
+ * with nothing else in it as empty.
+ */
+int is_dir_index(struct m_inode * dir, struct dir_entry * de, int nr)
+{
+	struct m_inode * inode;
+	int ret;
+
+	if (nr != INDEX_SLOT || !de->inode ||
+	    strncmp(de->name,INDEX_NAME,NAME_LEN) ||
+	    !(inode = iget(dir->i_dev,de->inode)))
+		return 0;
+	ret = IS_DIRINDEX(inode);
+	iput(inode);
+	return ret;
+}
+
+/* throw away the index of a directory that is being removed */
+void dir_index_drop(struct m_inode * dir)
+{
+	struct m_inode * index;
+	struct buffer_head * bh;
+	struct dir_entry * de;
+
+	lock_index(dir);
+	if ((index = get_index(dir))) {
+		if ((bh = get_entry(dir,INDEX_SLOT,&de))) {
+			de->inode = 0;
+			bh->b_dirt = 1;
+			brelse(bh);
+		}
+		index->i_nlinks = 0;
+		index->i_dirt = 1;
+		iput(index);
+	}
+	unlock_index(dir);
+}
@@ -158,7 +158,7 @@ static unsigned long change_ldt(unsigned long text_size,unsigned long * page)
 
 	code_limit = text_size+PAGE_SIZE -1;
 	code_limit &= 0xFFFFF000;
-	data_limit = 0x4000000;
+	data_limit = TASK_SIZE;
 	code_base = get_base(current->ldt[1]);
 	data_base = code_base;
 	set_base(current->ldt[1],code_base);
@@ -190,6 +190,7 @@ int do_execve(unsigned long * eip,long tmp,char * filename,
 	int e_uid, e_gid;
 	int retval;
 	int sh_bang = 0;
+	unsigned long new_dir = 0;
 	unsigned long p=PAGE_SIZE*MAX_ARG_PAGES-4;
 
 	if ((0xffff & eip[1]) != 0x000f)
@@ -315,6 +316,11 @@ restart_interp:
 			goto exec_error2;
 		}
 	}
+/* a vfork()ed child needs an address space of its own from here on */
+	if (current->vfork && !(new_dir = new_page_dir())) {
+		retval = -ENOMEM;
+		goto exec_error2;
+	}
 /* OK, This is the point of no return */
 	if (current->executable)
 		iput(current->executable);
@@ -326,8 +332,13 @@ restart_interp:
 		if ((current->close_on_exec>>i)&1)
 			sys_close(i);
 	current->close_on_exec = 0;
-	free_page_tables(get_base(current->ldt[1]),get_limit(0x0f));
-	free_page_tables(get_base(current->ldt[2]),get_limit(0x17));
+	if (current->vfork)
+		vfork_release(new_dir);
+	else {
+		exit_mmap();
+		free_page_tables(get_base(current->ldt[1]),get_limit(0x0f),current->tss.cr3);
+		free_page_tables(get_base(current->ldt[2]),get_limit(0x17),current->tss.cr3);
+	}
 	if (last_task_used_math == current)
 		last_task_used_math = NULL;
 	current->used_math = 0;
@@ -67,6 +67,14 @@ int sys_fcntl(unsigned int fd, unsigned int cmd, unsigned long arg)
 			filp->f_flags &= ~(O_APPEND | O_NONBLOCK);
 			filp->f_flags |= arg & (O_APPEND | O_NONBLOCK);
 			return 0;
+		case F_GETPIPE_SZ:
+			if (!filp->f_inode->i_pipe)
+				return -EBADF;
+			return PIPE_BUF_SIZE(*filp->f_inode);
+		case F_SETPIPE_SZ:
+			if (!filp->f_inode->i_pipe)
+				return -EBADF;
+			return pipe_set_size(filp->f_inode,arg);
 		case F_GETLK:	case F_SETLK:	case F_SETLKW:
 			return -1;
 		default:
@@ -14,6 +14,65 @@
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #define MAX(a,b) (((a)>(b))?(a):(b))
 
+/* read-ahead window limits, in blocks */
+#define MIN_READAHEAD 2
+#define MAX_READAHEAD 32
+
+/* how far ahead of the reader blocks are queued, at most */
+#define ra_limit() MAX(MIN_READAHEAD,MIN(MAX_READAHEAD,NR_BUFFERS/4))
+
+/*
+ * Queue with READA what the reader at filp->f_pos needs for the 'left'
+ * bytes it still wants and the window after them, but no more than
+ * ra_limit() blocks ahead of it: a large read() gets its blocks queued a
+ * piece at a time as it goes, so read-ahead can't push them out of the
+ * buffer cache before bread() gets to them. Blocks before f_raend have
+ * been queued already.
+ */
+static void queue_readahead(struct m_inode * inode, struct file * filp,
+	int left)
+{
+	unsigned long block, last, end;
+	int nr;
+
+	block = filp->f_pos / BLOCK_SIZE;
+	end = (inode->i_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	last = (filp->f_pos + left - 1) / BLOCK_SIZE + filp->f_reada;
+	if (last > block + ra_limit())
+		last = block + ra_limit();
+	if (last >= end)
+		last = end - 1;
+	if (block < filp->f_raend)
+		block = filp->f_raend;
+	if (block > last || (block == last && !filp->f_reada))
+		return;
+	filp->f_raend = last + 1;
+	for ( ; block <= last ; block++)
+		if ((nr = bmap(inode,block)))
+			reada_block(inode->i_dev,nr);
+}
+
+/*
+ * A read that starts where the previous one left off is sequential, and
+ * doubles the read-ahead window; anything else halves it, and forgets
+ * what was queued for the old position. The blocks of this read and the
+ * window after it are then queued, so the bread()s below mostly find
+ * them in flight, merged into few requests.
+ */
+static void file_readahead(struct m_inode * inode, struct file * filp,
+	int count)
+{
+	if (filp->f_pos / BLOCK_SIZE == filp->f_rablock)
+		filp->f_reada = MIN(MAX(filp->f_reada*2,MIN_READAHEAD),
+			MAX_READAHEAD);
+	else {
+		filp->f_reada >>= 1;
+		filp->f_raend = 0;
+	}
+	filp->f_rablock = (filp->f_pos + count) / BLOCK_SIZE;
+	queue_readahead(inode,filp,count);
+}
+
 int file_read(struct m_inode * inode, struct file * filp, char * buf, int count)
 {
 	int left,chars,nr;
@@ -21,7 +80,14 @@ int file_read(struct m_inode * inode, struct file * filp, char * buf, int count)
 
 	if ((left=count)<=0)
 		return 0;
+	sync_mappings(inode);
+	if (filp->f_pos < inode->i_size)
+		file_readahead(inode,filp,count);
 	while (left) {
+/* half way through what was queued: queue the next piece of the read */
+		if (filp->f_pos / BLOCK_SIZE + ra_limit()/2 >= filp->f_raend &&
+		    filp->f_pos < inode->i_size)
+			queue_readahead(inode,filp,left);
 		if ((nr = bmap(inode,(filp->f_pos)/BLOCK_SIZE))) {
 			if (!(bh=bread(inode->i_dev,nr)))
 				break;
@@ -32,14 +98,11 @@ int file_read(struct m_inode * inode, struct file * filp, char * buf, int count)
 		filp->f_pos += chars;
 		left -= chars;
 		if (bh) {
-			char * p = nr + bh->b_data;
-			while (chars-->0)
-				put_fs_byte(*(p++),buf++);
+			copy_to_user(buf,nr + bh->b_data,chars);
 			brelse(bh);
-		} else {
-			while (chars-->0)
-				put_fs_byte(0,buf++);
-		}
+		} else
+			clear_user(buf,chars);
+		buf += chars;
 	}
 	inode->i_atime = CURRENT_TIME;
 	return (count-left)?(count-left):-ERROR;
@@ -51,7 +114,7 @@ int file_write(struct m_inode * inode, struct file * filp, char * buf, int count
 	int block,c;
 	struct buffer_head * bh;
 	char * p;
-	int i=0;
+	int i=0, whole;
 
 /*
  * ok, append may not work when many processes are writing at the same time
@@ -64,11 +127,15 @@ int file_write(struct m_inode * inode, struct file * filp, char * buf, int count
 	while (i<count) {
 		if (!(block = create_block(inode,pos/BLOCK_SIZE)))
 			break;
-		if (!(bh=bread(inode->i_dev,block)))
-			break;
 		c = pos % BLOCK_SIZE;
+/* a block that is written over as a whole needn't be read first */
+		if ((whole = !c && count-i >= BLOCK_SIZE))
+			bh = overwrite_block(inode->i_dev,block,buf);
+		else
+			bh = bread(inode->i_dev,block);
+		if (!bh)
+			break;
 		p = c + bh->b_data;
-		bh->b_dirt = 1;
 		c = BLOCK_SIZE-c;
 		if (c > count-i) c = count-i;
 		pos += c;
@@ -77,10 +144,16 @@ int file_write(struct m_inode * inode, struct file * filp, char * buf, int count
 			inode->i_dirt = 1;
 		}
 		i += c;
-		while (c-->0)
-			*(p++) = get_fs_byte(buf++);
+		if (!whole) {
+			copy_from_user(p,buf,c);
+			bh->b_dirt = 1;
+		}
+		update_mapped_pages(inode,pos-c,p,c);
+		buf += c;
 		brelse(bh);
 	}
+	if (i)
+		invalidate_file_pages(inode,pos-i,i);
 	inode->i_mtime = CURRENT_TIME;
 	if (!(filp->f_flags & O_APPEND)) {
 		filp->f_pos = pos;
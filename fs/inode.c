@@ -12,7 +12,26 @@
 #include <linux/mm.h>
 #include <asm/system.h>
 
-struct m_inode inode_table[NR_INODE]={{0,},};
+/*
+ * The inode table is sized from memory in inode_init(). Inodes that are
+ * in use or cached are hashed on (dev, ino), so iget() finds them in a
+ * short chain. Those with i_count zero are also on a circular free list
+ * that free_inodes points at the oldest entry of: get_empty_inode()
+ * reuses cached inodes least recently used first, and empty ones (dev
+ * 0) are put at the head to go before any of them. An inode is on the
+ * list exactly when i_next_free is set.
+ */
+struct m_inode * inode_table;
+int nr_inodes = 0;
+static struct m_inode ** inode_hash;
+static int inode_hash_shift = 32;
+static struct m_inode * free_inodes = NULL;
+static int nr_free_inodes = 0;
+static long nr_iget = 0, nr_iget_hits = 0;
+
+#define _inode_hashfn(dev,nr) \
+((((unsigned)(dev)<<16 ^ (unsigned)(nr)) * 0x9E3779B1U) >> inode_hash_shift)
+#define inode_hashp(dev,nr) (inode_hash + _inode_hashfn(dev,nr))
 
 static void read_inode(struct m_inode * inode);
 static void write_inode(struct m_inode * inode);
@@ -40,6 +59,117 @@ static inline void unlock_inode(struct m_inode * inode)
 	wake_up(&inode->i_wait);
 }
 
+static void remove_inode_hash(struct m_inode * inode)
+{
+	struct m_inode ** p;
+
+	if (!inode->i_dev)
+		return;
+	p = inode_hashp(inode->i_dev,inode->i_num);
+	if (inode->i_next)
+		inode->i_next->i_prev = inode->i_prev;
+	if (inode->i_prev)
+		inode->i_prev->i_next = inode->i_next;
+	if (*p == inode)
+		*p = inode->i_next;
+	inode->i_next = inode->i_prev = NULL;
+}
+
+void insert_inode_hash(struct m_inode * inode)
+{
+	struct m_inode ** p;
+
+	inode->i_next = inode->i_prev = NULL;
+	if (!inode->i_dev)
+		return;
+	p = inode_hashp(inode->i_dev,inode->i_num);
+	if ((inode->i_next = *p))
+		inode->i_next->i_prev = inode;
+	*p = inode;
+}
+
+static void remove_free_inode(struct m_inode * inode)
+{
+	if (!inode->i_next_free)
+		return;
+	if (inode->i_next_free == inode)
+		free_inodes = NULL;
+	else {
+		inode->i_prev_free->i_next_free = inode->i_next_free;
+		inode->i_next_free->i_prev_free = inode->i_prev_free;
+		if (free_inodes == inode)
+			free_inodes = inode->i_next_free;
+	}
+	inode->i_next_free = inode->i_prev_free = NULL;
+	nr_free_inodes--;
+}
+
+/* put an unused inode on the free list, at the head if it is empty */
+static void put_free_inode(struct m_inode * inode)
+{
+	remove_free_inode(inode);
+	if (!free_inodes) {
+		free_inodes = inode;
+		inode->i_prev_free = inode;
+	}
+	inode->i_next_free = free_inodes;
+	inode->i_prev_free = free_inodes->i_prev_free;
+	free_inodes->i_prev_free->i_next_free = inode;
+	free_inodes->i_prev_free = inode;
+	if (!inode->i_dev)
+		free_inodes = inode;
+	nr_free_inodes++;
+}
+
+/* forget everything about an inode that has just gone unused */
+void clear_inode(struct m_inode * inode)
+{
+	remove_free_inode(inode);
+	remove_inode_hash(inode);
+	invalidate_file_pages(inode,0,-1);
+	memset(inode,0,sizeof(*inode));
+	put_free_inode(inode);
+}
+
+/*
+ * About one inode per 16kB of memory, and one hash chain per inode,
+ * taken from the page allocator.
+ */
+void inode_init(void)
+{
+	unsigned long mem;
+	int i, order, nr = HIGH_MEMORY >> 14;
+
+	if (nr < 64)
+		nr = 64;
+	if (nr > 2048)
+		nr = 2048;
+	for (i = 64, inode_hash_shift = 26 ; i < nr ; i <<= 1)
+		inode_hash_shift--;
+	for (order = 0 ; (PAGE_SIZE << order) <
+	     i * sizeof(struct m_inode *) + nr * sizeof(struct m_inode) ;
+	     order++)
+		/* nothing */ ;
+	if (!(mem = get_free_pages(order)))
+		panic("No memory for the inode table");
+	inode_hash = (struct m_inode **) mem;
+	inode_table = (struct m_inode *) (inode_hash + i);
+	nr_inodes = ((PAGE_SIZE << order) - i * sizeof(struct m_inode *)) /
+		sizeof(struct m_inode);
+	while (i--)
+		inode_hash[i] = NULL;
+	for (i = 0 ; i < nr_inodes ; i++) {
+		memset(inode_table+i,0,sizeof(struct m_inode));
+		put_free_inode(inode_table+i);
+	}
+}
+
+void show_inode_stat(void)
+{
+	printk("inodes: %d, %d unused; %d igets, %d hits\n\r",
+		nr_inodes,nr_free_inodes,nr_iget,nr_iget_hits);
+}
+
 void invalidate_inodes(int dev)
 {
 	int i;
@@ -51,7 +181,10 @@ void invalidate_inodes(int dev)
 		if (inode->i_dev == dev) {
 			if (inode->i_count)
 				printk("inode in use on removed disk\n\r");
+			remove_inode_hash(inode);
 			inode->i_dev = inode->i_dirt = 0;
+			if (!inode->i_count)
+				put_free_inode(inode);
 		}
 	}
 }
@@ -69,18 +202,30 @@ void sync_inodes(void)
 	}
 }
 
+/*
+ * New blocks are asked for right after the block before them (or after
+ * the indirect block that points at them), to keep files contiguous.
+ * A regular file that grows by its next block is being extended in
+ * order, and has zones preallocated for it.
+ */
+#define after(block) ((block) ? (block)+1 : 0)
+
 static int _bmap(struct m_inode * inode,int block,int create)
 {
 	struct buffer_head * bh;
-	int i;
+	unsigned short * p;
+	int i, extend;
 
 	if (block<0)
 		panic("_bmap: block<0");
 	if (block >= 7+512+512*512)
 		panic("_bmap: block>big");
+	extend = create && S_ISREG(inode->i_mode) &&
+		block == (inode->i_size + BLOCK_SIZE-1)/BLOCK_SIZE;
 	if (block<7) {
 		if (create && !inode->i_zone[block])
-			if ((inode->i_zone[block]=new_block(inode->i_dev))) {
+			if ((inode->i_zone[block]=new_file_block(inode,
+			    block ? after(inode->i_zone[block-1]) : 0,extend))) {
 				inode->i_ctime=CURRENT_TIME;
 				inode->i_dirt=1;
 			}
@@ -89,7 +234,8 @@ static int _bmap(struct m_inode * inode,int block,int create)
 	block -= 7;
 	if (block<512) {
 		if (create && !inode->i_zone[7])
-			if ((inode->i_zone[7]=new_block(inode->i_dev))) {
+			if ((inode->i_zone[7]=new_file_block(inode,
+			    after(inode->i_zone[6]),extend))) {
 				inode->i_dirt=1;
 				inode->i_ctime=CURRENT_TIME;
 			}
@@ -97,10 +243,12 @@ static int _bmap(struct m_inode * inode,int block,int create)
 			return 0;
 		if (!(bh = bread(inode->i_dev,inode->i_zone[7])))
 			return 0;
-		i = ((unsigned short *) (bh->b_data))[block];
+		p = (unsigned short *) bh->b_data;
+		i = p[block];
 		if (create && !i)
-			if ((i=new_block(inode->i_dev))) {
-				((unsigned short *) (bh->b_data))[block]=i;
+			if ((i=new_file_block(inode,
+			    after(block ? p[block-1] : inode->i_zone[7]),extend))) {
+				p[block]=i;
 				bh->b_dirt=1;
 			}
 		brelse(bh);
@@ -108,7 +256,8 @@ static int _bmap(struct m_inode * inode,int block,int create)
 	}
 	block -= 512;
 	if (create && !inode->i_zone[8])
-		if ((inode->i_zone[8]=new_block(inode->i_dev))) {
+		if ((inode->i_zone[8]=new_file_block(inode,
+		    after(inode->i_zone[7]),extend))) {
 			inode->i_dirt=1;
 			inode->i_ctime=CURRENT_TIME;
 		}
@@ -116,10 +265,12 @@ static int _bmap(struct m_inode * inode,int block,int create)
 		return 0;
 	if (!(bh=bread(inode->i_dev,inode->i_zone[8])))
 		return 0;
-	i = ((unsigned short *)bh->b_data)[block>>9];
+	p = (unsigned short *) bh->b_data;
+	i = p[block>>9];
 	if (create && !i)
-		if ((i=new_block(inode->i_dev))) {
-			((unsigned short *) (bh->b_data))[block>>9]=i;
+		if ((i=new_file_block(inode,
+		    after((block>>9) ? p[(block>>9)-1] : inode->i_zone[8]),extend))) {
+			p[block>>9]=i;
 			bh->b_dirt=1;
 		}
 	brelse(bh);
@@ -127,12 +278,13 @@ static int _bmap(struct m_inode * inode,int block,int create)
 		return 0;
 	if (!(bh=bread(inode->i_dev,i)))
 		return 0;
-	i = ((unsigned short *)bh->b_data)[block&511];
-	if (create && !i)
-		if ((i=new_block(inode->i_dev))) {
-			((unsigned short *) (bh->b_data))[block&511]=i;
+	p = (unsigned short *) bh->b_data;
+	block &= 511;
+	if (create && !p[block])
+		if ((p[block]=new_file_block(inode,
+		    after(block ? p[block-1] : i),extend)))
 			bh->b_dirt=1;
-		}
+	i = p[block];
 	brelse(bh);
 	return i;
 }
@@ -160,14 +312,16 @@ void iput(struct m_inode * inode)
 		wake_up(&inode->i_wait);
 		if (--inode->i_count)
 			return;
-		free_page(inode->i_size);
+		free_pipe(inode);
 		inode->i_count=0;
 		inode->i_dirt=0;
 		inode->i_pipe=0;
+		put_free_inode(inode);
 		return;
 	}
 	if (!inode->i_dev) {
-		inode->i_count--;
+		if (!--inode->i_count)
+			put_free_inode(inode);
 		return;
 	}
 	if (S_ISBLK(inode->i_mode)) {
@@ -179,6 +333,7 @@ repeat:
 		inode->i_count--;
 		return;
 	}
+	discard_prealloc(inode);
 	if (!inode->i_nlinks) {
 		truncate(inode);
 		free_inode(inode);
@@ -190,38 +345,39 @@ repeat:
 		goto repeat;
 	}
 	inode->i_count--;
+	put_free_inode(inode);
 	return;
 }
 
+/*
+ * Take the least recently used inode off the free list, preferring one
+ * that needn't be written out first. Returns NULL, instead of the panic
+ * there used to be, if every inode is in use.
+ */
 struct m_inode * get_empty_inode(void)
 {
 	struct m_inode * inode;
-	static struct m_inode * last_inode = inode_table;
 	int i;
 
 	do {
-		inode = NULL;
-		for (i = NR_INODE; i ; i--) {
-			if (++last_inode >= inode_table + NR_INODE)
-				last_inode = inode_table;
-			if (!last_inode->i_count) {
-				inode = last_inode;
-				if (!inode->i_dirt && !inode->i_lock)
-					break;
-			}
-		}
-		if (!inode) {
-			for (i=0 ; i<NR_INODE ; i++)
-				printk("%04x: %6d\t",inode_table[i].i_dev,
-					inode_table[i].i_num);
-			panic("No free inodes in mem");
+		if (!(inode = free_inodes)) {
+			printk("No free inodes in mem\n\r");
+			return NULL;
 		}
+		for (i = nr_free_inodes ; i-- > 0 ; inode = inode->i_next_free)
+			if (!inode->i_dirt && !inode->i_lock)
+				break;
+		if (i < 0)
+			inode = free_inodes;
 		wait_on_inode(inode);
 		while (inode->i_dirt) {
 			write_inode(inode);
 			wait_on_inode(inode);
 		}
-	} while (inode->i_count);
+	} while (inode->i_count || !inode->i_next_free);
+	remove_free_inode(inode);
+	remove_inode_hash(inode);
+	invalidate_file_pages(inode,0,-1);
 	memset(inode,0,sizeof(*inode));
 	inode->i_count = 1;
 	return inode;
@@ -233,63 +389,62 @@ struct m_inode * get_pipe_inode(void)
 
 	if (!(inode = get_empty_inode()))
 		return NULL;
-	if (!(inode->i_size=get_free_page())) {
-		inode->i_count = 0;
+	if (!init_pipe(inode)) {
+		iput(inode);
 		return NULL;
 	}
 	inode->i_count = 2;	/* sum of readers/writers */
-	PIPE_HEAD(*inode) = PIPE_TAIL(*inode) = 0;
 	inode->i_pipe = 1;
 	return inode;
 }
 
 struct m_inode * iget(int dev,int nr)
 {
-	struct m_inode * inode, * empty;
+	struct m_inode * inode, * tmp;
 
 	if (!dev)
 		panic("iget with dev==0");
-	empty = get_empty_inode();
-	inode = inode_table;
-	while (inode < NR_INODE+inode_table) {
-		if (inode->i_dev != dev || inode->i_num != nr) {
-			inode++;
-			continue;
-		}
-		wait_on_inode(inode);
-		if (inode->i_dev != dev || inode->i_num != nr) {
-			inode = inode_table;
-			continue;
-		}
-		inode->i_count++;
-		if (inode->i_mount) {
-			int i;
-
-			for (i = 0 ; i<NR_SUPER ; i++)
-				if (super_block[i].s_imount==inode)
-					break;
-			if (i >= NR_SUPER) {
-				printk("Mounted inode hasn't got sb\n");
-				if (empty)
-					iput(empty);
-				return inode;
+	nr_iget++;
+repeat:
+	for (inode = *inode_hashp(dev,nr) ; inode ; inode = inode->i_next)
+		if (inode->i_dev == dev && inode->i_num == nr)
+			break;
+	if (!inode) {
+		if (!(inode = get_empty_inode()))
+			return NULL;
+/* get_empty_inode() can sleep: somebody may have read it meanwhile */
+		for (tmp = *inode_hashp(dev,nr) ; tmp ; tmp = tmp->i_next)
+			if (tmp->i_dev == dev && tmp->i_num == nr) {
+				iput(inode);
+				goto repeat;
 			}
-			iput(inode);
-			dev = super_block[i].s_dev;
-			nr = ROOT_INO;
-			inode = inode_table;
-			continue;
-		}
-		if (empty)
-			iput(empty);
+		inode->i_dev = dev;
+		inode->i_num = nr;
+		insert_inode_hash(inode);
+		read_inode(inode);
 		return inode;
 	}
-	if (!empty)
-		return (NULL);
-	inode=empty;
-	inode->i_dev = dev;
-	inode->i_num = nr;
-	read_inode(inode);
+	nr_iget_hits++;
+	wait_on_inode(inode);
+	if (inode->i_dev != dev || inode->i_num != nr)
+		goto repeat;
+	remove_free_inode(inode);
+	inode->i_count++;
+	if (inode->i_mount) {
+		int i;
+
+		for (i = 0 ; i<NR_SUPER ; i++)
+			if (super_block[i].s_imount==inode)
+				break;
+		if (i >= NR_SUPER) {
+			printk("Mounted inode hasn't got sb\n");
+			return inode;
+		}
+		iput(inode);
+		dev = super_block[i].s_dev;
+		nr = ROOT_INO;
+		goto repeat;
+	}
 	return inode;
 }
 
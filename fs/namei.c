@@ -77,6 +77,25 @@ static int match(int len,const char * name,struct dir_entry * de)
 	return same;
 }
 
+/*
+ * copy a name from user space for the name cache and directory
+ * indexes, truncated as find_entry() does. Returns the length, or -1 if it is too long.
+ */
+static int get_name(char * buf, const char * name, int namelen)
+{
+	int i;
+
+	if (namelen > NAME_LEN)
+#ifdef NO_TRUNCATE
+		return -1;
+#else
+		namelen = NAME_LEN;
+#endif
+	for (i = 0 ; i < namelen ; i++)
+		buf[i] = get_fs_byte(name+i);
+	return namelen;
+}
+
 /*
  *	find_entry()
  *
@@ -87,6 +106,8 @@ static int match(int len,const char * name,struct dir_entry * de)
  *
  * This also takes care of the few special cases due to '..'-traversal
  * over a pseudo-root and a mount point.
+ *
+ * Large directories are looked up through their index, see dir_index.c.
  */
 static struct buffer_head * find_entry(struct m_inode ** dir,
 	const char * name, int namelen, struct dir_entry ** res_dir)
@@ -96,6 +117,7 @@ static struct buffer_head * find_entry(struct m_inode ** dir,
 	struct buffer_head * bh;
 	struct dir_entry * de;
 	struct super_block * sb;
+	char buf[NAME_LEN];
 
 #ifdef NO_TRUNCATE
 	if (namelen > NAME_LEN)
@@ -124,6 +146,9 @@ static struct buffer_head * find_entry(struct m_inode ** dir,
 			}
 		}
 	}
+	if ((i = get_name(buf,name,namelen)) > 0 &&
+	    (i = dir_index_find(*dir,buf,i,&bh,res_dir)) >= 0)
+		return i ? bh : NULL;
 	if (!(block = (*dir)->i_zone[0]))
 		return NULL;
 	if (!(bh = bread((*dir)->i_dev,block)))
@@ -168,6 +193,7 @@ static struct buffer_head * add_entry(struct m_inode * dir,
 	int block,i;
 	struct buffer_head * bh;
 	struct dir_entry * de;
+	char buf[NAME_LEN];
 
 	*res_dir = NULL;
 #ifdef NO_TRUNCATE
@@ -179,6 +205,9 @@ static struct buffer_head * add_entry(struct m_inode * dir,
 #endif
 	if (!namelen)
 		return NULL;
+	if ((i = get_name(buf,name,namelen)) > 0 &&
+	    (i = dir_index_add(dir,buf,i,&bh,res_dir)) >= 0)
+		return i ? bh : NULL;
 	if (!(block = dir->i_zone[0]))
 		return NULL;
 	if (!(bh = bread(dir->i_dev,block)))
@@ -219,6 +248,47 @@ static struct buffer_head * add_entry(struct m_inode * dir,
 	return NULL;
 }
 
+/*
+ *	lookup()
+ *
+ * returns the inode number of 'name' in *dir, or 0 if there is none,
+ * going to the directory itself (find_entry()) only if the name cache
+ * doesn't know. The '..' magic of find_entry() depends on where it is
+ * done, so such lookups are not cached.
+ */
+static int lookup(struct m_inode ** dir, const char * name, int namelen)
+{
+	char buf[NAME_LEN];
+	struct buffer_head * bh;
+	struct dir_entry * de;
+	unsigned long version;
+	int len, inr, cache;
+
+	if ((len = get_name(buf,name,namelen)) <= 0)
+		return 0;
+	cache = !(len == 2 && buf[0] == '.' && buf[1] == '.' &&
+		((*dir) == current->root || (*dir)->i_num == ROOT_INO));
+	if (cache && dcache_lookup(*dir,buf,len,&inr))
+		return inr;
+	version = dcache_version;
+	bh = find_entry(dir,name,namelen,&de);
+	inr = bh ? de->inode : 0;
+	brelse(bh);
+	if (cache && version == dcache_version)
+		dcache_add(*dir,buf,len,inr);
+	return inr;
+}
+
+/* the entry for 'name' in 'dir' has changed */
+static void forget_name(struct m_inode * dir, const char * name, int namelen)
+{
+	char buf[NAME_LEN];
+	int len;
+
+	if ((len = get_name(buf,name,namelen)) > 0)
+		dcache_forget(dir,buf,len);
+}
+
 /*
  *	get_dir()
  *
@@ -230,9 +300,7 @@ static struct m_inode * get_dir(const char * pathname)
 	char c;
 	const char * thisname;
 	struct m_inode * inode;
-	struct buffer_head * bh;
 	int namelen,inr,idev;
-	struct dir_entry * de;
 
 	if (!current->root || !current->root->i_count)
 		panic("No root inode");
@@ -256,13 +324,11 @@ static struct m_inode * get_dir(const char * pathname)
 			/* nothing */ ;
 		if (!c)
 			return inode;
-		if (!(bh = find_entry(&inode,thisname,namelen,&de))) {
+		if (!(inr = lookup(&inode,thisname,namelen))) {
 			iput(inode);
 			return NULL;
 		}
-		inr = de->inode;
 		idev = inode->i_dev;
-		brelse(bh);
 		iput(inode);
 		if (!(inode = iget(idev,inr)))
 			return NULL;
@@ -305,21 +371,16 @@ struct m_inode * namei(const char * pathname)
 	const char * basename;
 	int inr,dev,namelen;
 	struct m_inode * dir;
-	struct buffer_head * bh;
-	struct dir_entry * de;
 
 	if (!(dir = dir_namei(pathname,&namelen,&basename)))
 		return NULL;
 	if (!namelen)			/* special case: '/usr/' etc */
 		return dir;
-	bh = find_entry(&dir,basename,namelen,&de);
-	if (!bh) {
+	if (!(inr = lookup(&dir,basename,namelen))) {
 		iput(dir);
 		return NULL;
 	}
-	inr = de->inode;
 	dev = dir->i_dev;
-	brelse(bh);
 	iput(dir);
 	dir=iget(dev,inr);
 	if (dir) {
@@ -357,8 +418,7 @@ int open_namei(const char * pathname, int flag, int mode,
 		iput(dir);
 		return -EISDIR;
 	}
-	bh = find_entry(&dir,basename,namelen,&de);
-	if (!bh) {
+	if (!(inr = lookup(&dir,basename,namelen))) {
 		if (!(flag & O_CREAT)) {
 			iput(dir);
 			return -ENOENT;
@@ -385,20 +445,19 @@ int open_namei(const char * pathname, int flag, int mode,
 		de->inode = inode->i_num;
 		bh->b_dirt = 1;
 		brelse(bh);
+		forget_name(dir,basename,namelen);
 		iput(dir);
 		*res_inode = inode;
 		return 0;
 	}
-	inr = de->inode;
 	dev = dir->i_dev;
-	brelse(bh);
 	iput(dir);
 	if (flag & O_EXCL)
 		return -EEXIST;
 	if (!(inode=iget(dev,inr)))
 		return -EACCES;
 	if ((S_ISDIR(inode->i_mode) && (flag & O_ACCMODE)) ||
-	    !permission(inode,ACC_MODE(flag))) {
+	    IS_DIRINDEX(inode) || !permission(inode,ACC_MODE(flag))) {
 		iput(inode);
 		return -EPERM;
 	}
@@ -417,7 +476,7 @@ int sys_mknod(const char * filename, int mode, int dev)
 	struct buffer_head * bh;
 	struct dir_entry * de;
 	
-	if (!suser())
+	if (!suser() || mode == I_DIRINDEX)
 		return -EPERM;
 	if (!(dir = dir_namei(filename,&namelen,&basename)))
 		return -ENOENT;
@@ -454,6 +513,7 @@ int sys_mknod(const char * filename, int mode, int dev)
 	}
 	de->inode = inode->i_num;
 	bh->b_dirt = 1;
+	forget_name(dir,basename,namelen);
 	iput(dir);
 	iput(inode);
 	brelse(bh);
@@ -494,7 +554,7 @@ int sys_mkdir(const char * pathname, int mode)
 	inode->i_size = 32;
 	inode->i_dirt = 1;
 	inode->i_mtime = inode->i_atime = CURRENT_TIME;
-	if (!(inode->i_zone[0]=new_block(inode->i_dev))) {
+	if (!(inode->i_zone[0]=new_block(inode->i_dev,dir->i_zone[0]))) {
 		iput(dir);
 		inode->i_nlinks--;
 		iput(inode);
@@ -529,6 +589,7 @@ int sys_mkdir(const char * pathname, int mode)
 	}
 	de->inode = inode->i_num;
 	bh->b_dirt = 1;
+	forget_name(dir,basename,namelen);
 	dir->i_nlinks++;
 	dir->i_dirt = 1;
 	iput(dir);
@@ -573,7 +634,7 @@ static int empty_dir(struct m_inode * inode)
 				return 0;
 			de = (struct dir_entry *) bh->b_data;
 		}
-		if (de->inode) {
+		if (de->inode && !is_dir_index(inode,de,nr)) {
 			brelse(bh);
 			return 0;
 		}
@@ -647,9 +708,13 @@ int sys_rmdir(const char * name)
 	}
 	if (inode->i_nlinks != 2)
 		printk("empty directory has nlink!=2 (%d)",inode->i_nlinks);
+	dir_index_remove(dir,de);
 	de->inode = 0;
 	bh->b_dirt = 1;
 	brelse(bh);
+	forget_name(dir,basename,namelen);
+	dcache_invalidate(inode->i_dev,inode->i_num);
+	dir_index_drop(inode);
 	inode->i_nlinks=0;
 	inode->i_dirt=1;
 	dir->i_nlinks--;
@@ -696,7 +761,7 @@ int sys_unlink(const char * name)
 		brelse(bh);
 		return -EPERM;
 	}
-	if (S_ISDIR(inode->i_mode)) {
+	if (S_ISDIR(inode->i_mode) || IS_DIRINDEX(inode)) {
 		iput(inode);
 		iput(dir);
 		brelse(bh);
@@ -707,9 +772,11 @@ int sys_unlink(const char * name)
 			inode->i_dev,inode->i_num,inode->i_nlinks);
 		inode->i_nlinks=1;
 	}
+	dir_index_remove(dir,de);
 	de->inode = 0;
 	bh->b_dirt = 1;
 	brelse(bh);
+	forget_name(dir,basename,namelen);
 	inode->i_nlinks--;
 	inode->i_dirt = 1;
 	inode->i_ctime = CURRENT_TIME;
@@ -729,7 +796,7 @@ int sys_link(const char * oldname, const char * newname)
 	oldinode=namei(oldname);
 	if (!oldinode)
 		return -ENOENT;
-	if (S_ISDIR(oldinode->i_mode)) {
+	if (S_ISDIR(oldinode->i_mode) || IS_DIRINDEX(oldinode)) {
 		iput(oldinode);
 		return -EPERM;
 	}
@@ -769,6 +836,7 @@ int sys_link(const char * oldname, const char * newname)
 	de->inode = oldinode->i_num;
 	bh->b_dirt = 1;
 	brelse(bh);
+	forget_name(dir,basename,namelen);
 	iput(dir);
 	oldinode->i_nlinks++;
 	oldinode->i_ctime = CURRENT_TIME;
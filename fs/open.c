@@ -10,6 +10,7 @@
 #include <sys/types.h>
 #include <utime.h>
 #include <sys/stat.h>
+#include <const.h>
 
 #include <linux/sched.h>
 #include <linux/tty.h>
@@ -112,6 +113,11 @@ int sys_chmod(const char * filename,int mode)
 		iput(inode);
 		return -EACCES;
 	}
+	if (IS_DIRINDEX(inode) ||
+	    ((mode & 07777) | (inode->i_mode & ~07777)) == I_DIRINDEX) {
+		iput(inode);
+		return -EPERM;
+	}
 	inode->i_mode = (mode & 07777) | (inode->i_mode & ~07777);
 	inode->i_dirt = 1;
 	iput(inode);
@@ -128,6 +134,10 @@ int sys_chown(const char * filename,int uid,int gid)
 		iput(inode);
 		return -EACCES;
 	}
+	if (inode->i_mode == I_DIRINDEX) {
+		iput(inode);
+		return -EPERM;
+	}
 	inode->i_uid=uid;
 	inode->i_gid=gid;
 	inode->i_dirt=1;
@@ -182,6 +192,8 @@ int sys_open(const char * filename,int flag,int mode)
 	f->f_count = 1;
 	f->f_inode = inode;
 	f->f_pos = 0;
+	f->f_reada = 0;
+	f->f_rablock = f->f_raend = 0;
 	return (fd);
 }
 
@@ -5,14 +5,37 @@
  */
 
 #include <signal.h>
+#include <errno.h>
+#include <string.h>
 
 #include <linux/sched.h>
-#include <linux/mm.h>	/* for get_free_page */
+#include <linux/kernel.h>
+#include <linux/mm.h>	/* for get_dirty_page */
 #include <asm/segment.h>
 
+/*
+ * The slot that byte 'pos' of the pipe lives in, and its offset there.
+ */
+#define PIPE_SLOT(pipe,pos) (((pos) / PAGE_SIZE) & ((pipe)->nr_pages-1))
+#define PIPE_OFF(pos) ((pos) & (PAGE_SIZE-1))
+
+/*
+ * A slot holding a page lent by a writer gets its own page back once
+ * the reader is done with it.
+ */
+static inline void return_page(struct pipe_inode_info * pipe, int slot)
+{
+	if (pipe->page[slot] != pipe->own[slot]) {
+		free_page(pipe->page[slot]);
+		pipe->page[slot] = pipe->own[slot];
+	}
+}
+
 int read_pipe(struct m_inode * inode, char * buf, int count)
 {
-	int chars, size, read = 0;
+	struct pipe_inode_info * pipe = PIPE_INFO(*inode);
+	int chars, size, slot, read = 0;
+	unsigned long pos;
 
 	while (count>0) {
 		while (!(size=PIPE_SIZE(*inode))) {
@@ -21,29 +44,44 @@ int read_pipe(struct m_inode * inode, char * buf, int count)
 				return read;
 			sleep_on(&inode->i_wait);
 		}
-		chars = PAGE_SIZE-PIPE_TAIL(*inode);
+		pos = pipe->tail;
+		slot = PIPE_SLOT(pipe,pos);
+		chars = PAGE_SIZE-PIPE_OFF(pos);
 		if (chars > count)
 			chars = count;
 		if (chars > size)
 			chars = size;
 		count -= chars;
 		read += chars;
-		size = PIPE_TAIL(*inode);
-		PIPE_TAIL(*inode) += chars;
-		PIPE_TAIL(*inode) &= (PAGE_SIZE-1);
-		while (chars-->0)
-			put_fs_byte(((char *)inode->i_size)[size++],buf++);
+		pipe->tail += chars;
+		copy_to_user(buf,PIPE_OFF(pos) + (char *) pipe->page[slot],chars);
+		buf += chars;
+		if (!PIPE_OFF(pipe->tail))
+			return_page(pipe,slot);
 	}
 	wake_up(&inode->i_wait);
 	return read;
 }
-	
+
+/*
+ * A page-aligned write of a whole page into an empty slot lends the
+ * writer's page to the pipe instead of copying it, see lend_user_page().
+ * Nothing may be written into a lent page, so its slot counts as full
+ * until the reader has returned it.
+ */
 int write_pipe(struct m_inode * inode, char * buf, int count)
 {
-	int chars, size, written = 0;
+	struct pipe_inode_info * pipe = PIPE_INFO(*inode);
+	int chars, size, slot, written = 0;
+	unsigned long pos, page;
 
 	while (count>0) {
-		while (!(size=(PAGE_SIZE-1)-PIPE_SIZE(*inode))) {
+		for (;;) {
+			pos = pipe->head;
+			slot = PIPE_SLOT(pipe,pos);
+			size = PIPE_BUF_SIZE(*inode)-PIPE_SIZE(*inode);
+			if (size && pipe->page[slot] == pipe->own[slot])
+				break;
 			wake_up(&inode->i_wait);
 			if (inode->i_count != 2) { /* no readers */
 				current->signal |= (1<<(SIGPIPE-1));
@@ -51,23 +89,120 @@ int write_pipe(struct m_inode * inode, char * buf, int count)
 			}
 			sleep_on(&inode->i_wait);
 		}
-		chars = PAGE_SIZE-PIPE_HEAD(*inode);
+		if (!PIPE_OFF(pos) && size >= PAGE_SIZE && count >= PAGE_SIZE &&
+		    !PIPE_OFF((unsigned long) buf) &&
+		    (page = lend_user_page((unsigned long) buf))) {
+			pipe->page[slot] = page;
+			pipe->head += PAGE_SIZE;
+			count -= PAGE_SIZE;
+			written += PAGE_SIZE;
+			buf += PAGE_SIZE;
+			continue;
+		}
+		chars = PAGE_SIZE-PIPE_OFF(pos);
 		if (chars > count)
 			chars = count;
 		if (chars > size)
 			chars = size;
 		count -= chars;
 		written += chars;
-		size = PIPE_HEAD(*inode);
-		PIPE_HEAD(*inode) += chars;
-		PIPE_HEAD(*inode) &= (PAGE_SIZE-1);
-		while (chars-->0)
-			((char *)inode->i_size)[size++]=get_fs_byte(buf++);
+		pipe->head += chars;
+		copy_from_user(PIPE_OFF(pos) + (char *) pipe->page[slot],buf,chars);
+		buf += chars;
 	}
 	wake_up(&inode->i_wait);
 	return written;
 }
 
+static int alloc_pipe_pages(unsigned long * page, int nr)
+{
+	int i;
+
+	for (i=0 ; i<nr ; i++)
+		if (!(page[i] = get_dirty_page())) {
+			while (i--)
+				free_page(page[i]);
+			return 0;
+		}
+	return 1;
+}
+
+int init_pipe(struct m_inode * inode)
+{
+	struct pipe_inode_info * pipe;
+	int i;
+
+	if (!(pipe = (struct pipe_inode_info *) get_free_page()))
+		return 0;
+	if (!alloc_pipe_pages(pipe->own,PIPE_DEF_PAGES)) {
+		free_page((unsigned long) pipe);
+		return 0;
+	}
+	for (i=0 ; i<PIPE_DEF_PAGES ; i++)
+		pipe->page[i] = pipe->own[i];
+	pipe->nr_pages = PIPE_DEF_PAGES;
+	pipe->head = pipe->tail = 0;
+	inode->i_size = (unsigned long) pipe;
+	return 1;
+}
+
+void free_pipe(struct m_inode * inode)
+{
+	struct pipe_inode_info * pipe = PIPE_INFO(*inode);
+	int i;
+
+	for (i=0 ; i<pipe->nr_pages ; i++) {
+		return_page(pipe,i);
+		free_page(pipe->own[i]);
+	}
+	free_page((unsigned long) pipe);
+	inode->i_size = 0;
+}
+
+/*
+ * fcntl(F_SETPIPE_SZ): resize the ring to 'size' rounded up to a power
+ * of two pages. The data is copied over, so it has to fit.
+ */
+int pipe_set_size(struct m_inode * inode, unsigned long size)
+{
+	struct pipe_inode_info * pipe = PIPE_INFO(*inode);
+	unsigned long page[PIPE_MAX_PAGES];
+	unsigned long pos, len;
+	int nr, i, chars;
+
+	for (nr=1 ; nr*PAGE_SIZE < size ; nr <<= 1)
+		if (nr >= PIPE_MAX_PAGES)
+			return -EINVAL;
+	if (nr == pipe->nr_pages)
+		return nr*PAGE_SIZE;
+	if (PIPE_SIZE(*inode) > nr*PAGE_SIZE)
+		return -EBUSY;
+	if (!alloc_pipe_pages(page,nr))
+		return -ENOMEM;
+	for (pos=pipe->tail,len=0 ; pos != pipe->head ; pos += chars) {
+		chars = PAGE_SIZE-PIPE_OFF(pos);
+		if (chars > PAGE_SIZE-PIPE_OFF(len))
+			chars = PAGE_SIZE-PIPE_OFF(len);
+		if (chars > pipe->head-pos)
+			chars = pipe->head-pos;
+		memcpy(PIPE_OFF(len) + (char *) page[len >> 12],
+			PIPE_OFF(pos) + (char *) pipe->page[PIPE_SLOT(pipe,pos)],
+			chars);
+		len += chars;
+	}
+	for (i=0 ; i<pipe->nr_pages ; i++) {
+		return_page(pipe,i);
+		free_page(pipe->own[i]);
+	}
+	for (i=0 ; i<nr ; i++)
+		pipe->page[i] = pipe->own[i] = page[i];
+	pipe->nr_pages = nr;
+	pipe->tail = 0;
+	pipe->head = len;
+	wake_up(&inode->i_wait);
+	return nr*PAGE_SIZE;
+}
+
 int sys_pipe(unsigned long * fildes)
 {
 	struct m_inode * inode;
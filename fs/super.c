@@ -120,6 +120,7 @@ static struct super_block * read_super(int dev)
 	s->s_time = 0;
 	s->s_rd_only = 0;
 	s->s_dirt = 0;
+	s->s_zcursor = s->s_icursor = 0;
 	lock_super(s);
 	if (!(bh = bread(dev,1))) {
 		s->s_dev=0;
@@ -194,6 +195,8 @@ int sys_umount(char * dev_name)
 	sb->s_isup = NULL;
 	put_super(dev);
 	sync_dev(dev);
+	invalidate_dev_pages(dev);
+	dcache_invalidate(dev,0);
 	return 0;
 }
 
@@ -37,6 +37,78 @@ static inline void put_fs_long(unsigned long val,unsigned long * addr)
 __asm__ ("movl %0,%%fs:%1"::"r" (val),"m" (*addr));
 }
 
+/*
+ * Bulk copies between kernel memory and the user segment at %fs. The
+ * destination is brought to a long boundary with movsb, the bulk goes
+ * with rep movsl and the tail with movsb. rep movs writes through %es,
+ * so copy_to_user() and clear_user() load it from %fs for the duration.
+ */
+static inline void copy_to_user(char * to, const char * from, unsigned long n)
+{
+	unsigned long head = -(unsigned long) to & 3;
+	int d0,d1,d2;
+
+	if (head > n)
+		head = n;
+	n -= head;
+	__asm__ __volatile__("cld\n\t"
+		"push %%es\n\t"
+		"push %%fs\n\t"
+		"pop %%es\n\t"
+		"rep ; movsb\n\t"
+		"movl %%eax,%%ecx\n\t"
+		"rep ; movsl\n\t"
+		"movl %%edx,%%ecx\n\t"
+		"rep ; movsb\n\t"
+		"pop %%es"
+		:"=&c" (d0),"=&D" (d1),"=&S" (d2)
+		:"0" (head),"1" (to),"2" (from),"a" (n >> 2),"d" (n & 3)
+		:"memory");
+}
+
+static inline void copy_from_user(char * to, const char * from, unsigned long n)
+{
+	unsigned long head = -(unsigned long) to & 3;
+	int d0,d1,d2;
+
+	if (head > n)
+		head = n;
+	n -= head;
+	__asm__ __volatile__("cld\n\t"
+		"rep ; movsb %%fs:(%%esi),%%es:(%%edi)\n\t"
+		"movl %%eax,%%ecx\n\t"
+		"rep ; movsl %%fs:(%%esi),%%es:(%%edi)\n\t"
+		"movl %%edx,%%ecx\n\t"
+		"rep ; movsb %%fs:(%%esi),%%es:(%%edi)"
+		:"=&c" (d0),"=&D" (d1),"=&S" (d2)
+		:"0" (head),"1" (to),"2" (from),"a" (n >> 2),"d" (n & 3)
+		:"memory");
+}
+
+static inline void clear_user(char * to, unsigned long n)
+{
+	unsigned long head = -(unsigned long) to & 3;
+	int d0,d1;
+
+	if (head > n)
+		head = n;
+	n -= head;
+	__asm__ __volatile__("cld\n\t"
+		"push %%es\n\t"
+		"push %%fs\n\t"
+		"pop %%es\n\t"
+		"xorl %%eax,%%eax\n\t"
+		"rep ; stosb\n\t"
+		"movl %%esi,%%ecx\n\t"
+		"rep ; stosl\n\t"
+		"movl %%edx,%%ecx\n\t"
+		"rep ; stosb\n\t"
+		"pop %%es"
+		:"=&c" (d0),"=&D" (d1)
+		:"0" (head),"1" (to),"S" (n >> 2),"d" (n & 3)
+		:"ax","memory");
+}
+
 /*
  * Someone who knows GNU asm better than I should double check the followig.
  * It seems to work, but I don't know if I'm doing something subtly wrong.
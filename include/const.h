@@ -11,5 +11,6 @@
 #define I_NAMED_PIPE	0010000
 #define I_SET_UID_BIT   0004000
 #define I_SET_GID_BIT   0002000
+#define I_DIRINDEX	0107000		/* see fs/dir_index.c */
 
 #endif
@@ -45,4 +45,32 @@
  leave HD_TYPE undefined. This is the normal thing to do.
 */
 
+/*
+ * The hd driver uses READ/WRITE MULTIPLE whenever the drive supports it.
+ * Define HD_NO_MULTIPLE to go back to one interrupt per sector, and
+ * HD_DMA to use bus-master DMA if a PIIX IDE controller is found.
+ */
+/*#define HD_NO_MULTIPLE */
+/*#define HD_DMA */
+
+/*
+ * Block devices queue requests with the one-way elevator by default.
+ * Define BLK_DEADLINE to give the hard disk the deadline scheduler,
+ * which bounds how long reads and writes can be starved.
+ */
+/*#define BLK_DEADLINE */
+
+/*
+ * Define ALLOC_STATS to keep a histogram of page allocation times, shown
+ * by calc_mem(). It uses rdtsc, so it needs a Pentium or later.
+ */
+/*#define ALLOC_STATS */
+
+/*
+ * The number of processes allowed at boot, at most NR_TASKS. Left
+ * undefined, it is about one per four pages of main memory. Root can
+ * change it later with the maxtasks system call.
+ */
+/*#define MAX_TASKS 64 */
+
 #endif
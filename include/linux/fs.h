@@ -29,6 +29,8 @@
 #define WRITEA 3	/* "write-ahead" - silly, but somewhat useful */
 
 void buffer_init(long buffer_end);
+void inode_init(void);
+void dcache_init(void);
 
 #define MAJOR(a) (((unsigned)(a))>>8)
 #define MINOR(a) ((a)&0xff)
@@ -41,10 +43,10 @@ void buffer_init(long buffer_end);
 #define SUPER_MAGIC 0x137F
 
 #define NR_OPEN 20
-#define NR_INODE 32
+#define NR_INODE nr_inodes
 #define NR_FILE 64
 #define NR_SUPER 8
-#define NR_HASH 307
+#define NR_HASH nr_hash
 #define NR_BUFFERS nr_buffers
 #define BLOCK_SIZE 1024
 #define BLOCK_SIZE_BITS 10
@@ -55,16 +57,41 @@ void buffer_init(long buffer_end);
 #define INODES_PER_BLOCK ((BLOCK_SIZE)/(sizeof (struct d_inode)))
 #define DIR_ENTRIES_PER_BLOCK ((BLOCK_SIZE)/(sizeof (struct dir_entry)))
 
-#define PIPE_HEAD(inode) ((inode).i_zone[0])
-#define PIPE_TAIL(inode) ((inode).i_zone[1])
-#define PIPE_SIZE(inode) ((PIPE_HEAD(inode)-PIPE_TAIL(inode))&(PAGE_SIZE-1))
-#define PIPE_EMPTY(inode) (PIPE_HEAD(inode)==PIPE_TAIL(inode))
-#define PIPE_FULL(inode) (PIPE_SIZE(inode)==(PAGE_SIZE-1))
-#define INC_PIPE(head) \
-__asm__("incl %0\n\tandl $4095,%0"::"m" (head))
+/*
+ * A pipe inode's i_size points at its pipe_inode_info. The data is a
+ * ring of nr_pages pages; head and tail count bytes written and read,
+ * so the ring is full when they are a whole ring apart. A slot may hold
+ * a page lent by a writer instead of the pipe's own page, see pipe.c.
+ */
+#define PIPE_MAX_PAGES 16
+#define PIPE_DEF_PAGES 4
+
+struct pipe_inode_info {
+	unsigned long head, tail;
+	int nr_pages;				/* a power of two */
+	unsigned long page[PIPE_MAX_PAGES];	/* what each slot holds */
+	unsigned long own[PIPE_MAX_PAGES];	/* the pipe's own pages */
+};
+
+#define PIPE_INFO(inode) ((struct pipe_inode_info *) (inode).i_size)
+#define PIPE_SIZE(inode) (PIPE_INFO(inode)->head-PIPE_INFO(inode)->tail)
+#define PIPE_BUF_SIZE(inode) (PIPE_INFO(inode)->nr_pages*PAGE_SIZE)
+#define PIPE_EMPTY(inode) (PIPE_SIZE(inode)==0)
+#define PIPE_FULL(inode) (PIPE_SIZE(inode)==PIPE_BUF_SIZE(inode))
 
 typedef char buffer_block[BLOCK_SIZE];
 
+/*
+ * Unused buffers (b_count == 0) live on one of these LRU lists, oldest
+ * first. Buffers in use are on no list at all. Interrupts may unlock a
+ * buffer behind our back, so BUF_LOCKED is only a hint and gets refiled
+ * lazily by getblk().
+ */
+#define BUF_CLEAN	0
+#define BUF_LOCKED	1
+#define BUF_DIRTY	2
+#define NR_LIST		3
+
 struct buffer_head {
 	char * b_data;			/* pointer to data block (1024 bytes) */
 	unsigned long b_blocknr;	/* block number */
@@ -73,11 +100,14 @@ struct buffer_head {
 	unsigned char b_dirt;		/* 0-clean,1-dirty */
 	unsigned char b_count;		/* users using this block */
 	unsigned char b_lock;		/* 0 - ok, 1 -locked */
+	unsigned char b_list;		/* lru list we are on, if unused */
 	struct task_struct * b_wait;
 	struct buffer_head * b_prev;
 	struct buffer_head * b_next;
 	struct buffer_head * b_prev_free;
 	struct buffer_head * b_next_free;
+	struct buffer_head * b_reqnext;	/* next buffer in the same request */
+	long b_flushtime;		/* when bdflush should write it out */
 };
 
 struct d_inode {
@@ -111,6 +141,16 @@ struct m_inode {
 	unsigned char i_mount;
 	unsigned char i_seek;
 	unsigned char i_update;
+	unsigned char i_index_ok;		/* see dir_index.c */
+	unsigned char i_index_lock;
+	unsigned short i_wmaps;			/* shared writable mappings */
+	unsigned short i_cached;		/* pages in the page cache */
+	struct m_inode * i_next;		/* hash chain */
+	struct m_inode * i_prev;
+	struct m_inode * i_next_free;		/* unused inodes, oldest first */
+	struct m_inode * i_prev_free;
+	unsigned short i_prealloc;		/* zones reserved for the file */
+	unsigned short i_prealloc_count;
 };
 
 struct file {
@@ -119,6 +159,10 @@ struct file {
 	unsigned short f_count;
 	struct m_inode * f_inode;
 	off_t f_pos;
+/* read-ahead state, see file_read() */
+	unsigned short f_reada;		/* current window, in blocks */
+	unsigned long f_rablock;	/* where a sequential read goes on */
+	unsigned long f_raend;		/* read-ahead issued up to here */
 };
 
 struct super_block {
@@ -141,6 +185,7 @@ struct super_block {
 	unsigned char s_lock;
 	unsigned char s_rd_only;
 	unsigned char s_dirt;
+	int s_zcursor, s_icursor;	/* where bitmap searches go on from */
 };
 
 struct d_super_block {
@@ -159,11 +204,13 @@ struct dir_entry {
 	char name[NAME_LEN];
 };
 
-extern struct m_inode inode_table[NR_INODE];
+extern struct m_inode * inode_table;
+extern int nr_inodes;
 extern struct file file_table[NR_FILE];
 extern struct super_block super_block[NR_SUPER];
 extern struct buffer_head * start_buffer;
 extern int nr_buffers;
+extern int nr_hash;
 
 extern void check_disk_change(int dev);
 extern int floppy_change(unsigned int nr);
@@ -181,18 +228,59 @@ extern int open_namei(const char * pathname, int flag, int mode,
 extern void iput(struct m_inode * inode);
 extern struct m_inode * iget(int dev,int nr);
 extern struct m_inode * get_empty_inode(void);
+extern void insert_inode_hash(struct m_inode * inode);
+extern void clear_inode(struct m_inode * inode);
+extern void show_inode_stat(void);
 extern struct m_inode * get_pipe_inode(void);
+extern int init_pipe(struct m_inode * inode);
+extern void free_pipe(struct m_inode * inode);
+extern int pipe_set_size(struct m_inode * inode, unsigned long size);
 extern struct buffer_head * get_hash_table(int dev, int block);
 extern struct buffer_head * getblk(int dev, int block);
+extern struct buffer_head * overwrite_block(int dev, int block,
+	const char * buf);
 extern void ll_rw_block(int rw, struct buffer_head * bh);
+extern void show_blk_stat(void);
 extern void brelse(struct buffer_head * buf);
 extern struct buffer_head * bread(int dev,int block);
 extern void bread_page(unsigned long addr,int dev,int b[4]);
+extern void show_buffer_stat(void);
+extern void invalidate_file_pages(struct m_inode * inode, long pos, long count);
+extern void update_mapped_pages(struct m_inode * inode, unsigned long pos,
+	const char * data, int count);
+extern void sync_mappings(struct m_inode * inode);
+extern void invalidate_dev_pages(int dev);
+extern unsigned long dcache_version;
+extern int dcache_lookup(struct m_inode * dir, const char * name, int len,
+	int * ino);
+extern void dcache_add(struct m_inode * dir, const char * name, int len,
+	int ino);
+extern void dcache_forget(struct m_inode * dir, const char * name, int len);
+extern void dcache_invalidate(int dev, int dir);
+extern void show_dcache_stat(void);
+/*
+ * Directory indexes have a mode that can't be given to anything else,
+ * and belong to root. They can't be opened, changed or linked to.
+ */
+#define IS_DIRINDEX(inode) \
+((inode)->i_mode == I_DIRINDEX && !(inode)->i_uid)
+
+extern int dir_index_find(struct m_inode * dir, const char * name, int len,
+	struct buffer_head ** res_bh, struct dir_entry ** res_dir);
+extern int dir_index_add(struct m_inode * dir, const char * name, int len,
+	struct buffer_head ** res_bh, struct dir_entry ** res_dir);
+extern void dir_index_remove(struct m_inode * dir, struct dir_entry * de);
+extern int is_dir_index(struct m_inode * dir, struct dir_entry * de, int nr);
+extern void dir_index_drop(struct m_inode * dir);
 extern struct buffer_head * breada(int dev,int block,...);
-extern int new_block(int dev);
+extern void reada_block(int dev,int block);
+extern int new_block(int dev, int goal);
+extern int new_file_block(struct m_inode * inode, int goal, int extend);
+extern void discard_prealloc(struct m_inode * inode);
 extern void free_block(int dev, int block);
 extern struct m_inode * new_inode(int dev);
 extern void free_inode(struct m_inode * inode);
+extern void show_bitmap_stat(void);
 extern int sync_dev(int dev);
 extern struct super_block * get_super(int dev);
 extern int ROOT_DEV;
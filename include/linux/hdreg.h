@@ -40,6 +40,23 @@
 #define WIN_SEEK 		0x70
 #define WIN_DIAGNOSE		0x90
 #define WIN_SPECIFY		0x91
+#define WIN_MULTREAD		0xC4
+#define WIN_MULTWRITE		0xC5
+#define WIN_SETMULT		0xC6
+#define WIN_READDMA		0xC8
+#define WIN_WRITEDMA		0xCA
+#define WIN_IDENTIFY		0xEC
+
+/* Bus-master IDE registers, offsets from the PCI BAR4 base */
+#define BM_COMMAND	0
+#define BM_STATUS	2
+#define BM_PRD_ADDR	4
+
+/* Bits of BM_COMMAND and BM_STATUS */
+#define BM_START	0x01
+#define BM_READ		0x08	/* bus master writes to memory */
+#define BM_ERROR	0x02
+#define BM_INTR		0x04
 
 /* Bits for HD_ERROR */
 #define MARK_ERR	0x01	/* Bad address mark ? */
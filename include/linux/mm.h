@@ -3,8 +3,82 @@
 
 #define PAGE_SIZE 4096
 
+/* these are not to be changed without changing head.s etc */
+#define LOW_MEM 0x100000
+#define MAP_NR(addr) (((addr)-LOW_MEM)>>12)
+#define USED 100
+
+extern long HIGH_MEMORY;
+extern unsigned char * mem_map;
+
+#define PAGE_PRESENT	0x01
+#define PAGE_RW		0x02
+#define PAGE_USER	0x04
+#define PAGE_ACCESSED	0x20
+#define PAGE_DIRTY	0x40
+
+/*
+ * Every task has a page directory of its own, loaded from tss.cr3 on
+ * each task switch. Its entries below TASK_BASE are copied from pg_dir
+ * and map the kernel, the rest map the task. Task 0 runs on pg_dir.
+ */
+#define dir_entry(dir,addr) ((unsigned long *) (dir) + ((addr) >> 22))
+#define cur_dir_entry(addr) dir_entry(current->tss.cr3,addr)
+
+#define invalidate() \
+__asm__("movl %%eax,%%cr3"::"a" (current->tss.cr3))
+
 extern unsigned long get_free_page(void);
+extern unsigned long get_free_pages(int order);
+extern unsigned long get_dirty_page(void);
+extern unsigned long get_free_page_wait(void);
+extern unsigned long get_dirty_page_wait(void);
+extern int zero_idle_page(void);
+extern void free_pages(unsigned long addr, int order);
 extern unsigned long put_page(unsigned long page,unsigned long address);
 extern void free_page(unsigned long addr);
+extern unsigned long lend_user_page(unsigned long addr);
+extern void calc_mem(void);
+
+/*
+ * A page table entry that is not present but not zero holds the swap
+ * page number its page was written to, shifted left by two, and the
+ * PAGE_RW bit the page had, which it gets back when it comes in.
+ */
+#define SWP_ENTRY(nr,rw) (((nr) << 2) | ((rw) & PAGE_RW))
+#define SWP_NR(entry) ((entry) >> 2)
+
+extern int swap_dev;
+extern int swap_out(void);
+extern int swap_in(unsigned long * table_entry);
+extern void swap_duplicate(unsigned long entry);
+extern void swap_free(unsigned long entry);
+extern int ll_rw_page(int rw, int dev, int page, char * buffer);
+extern void show_swap_stat(void);
+
+/*
+ * Files mapped with mmap(). Addresses are relative to the start of the
+ * task's data segment, and the mappings of a task are kept sorted by
+ * them between MMAP_BASE and MMAP_END: brk() stays below, the stack
+ * above.
+ */
+#define NR_MMAP 8
+#define MMAP_BASE 0x40000000
+#define MMAP_END 0x7c000000
+
+struct vm_area {
+	unsigned long start, end;
+	struct m_inode * inode;
+	unsigned long offset;	/* file position of 'start' */
+	unsigned short prot, flags;
+};
+
+struct task_struct;
+
+extern struct vm_area * find_vma(unsigned long addr);
+extern unsigned long * find_pte(unsigned long address);
+extern void get_vma(struct vm_area * vma);
+extern int shared_write_page(struct task_struct * p, unsigned long addr);
+extern void exit_mmap(void);
 
 #endif
@@ -1,7 +1,16 @@
 #ifndef _SCHED_H
 #define _SCHED_H
 
-#define NR_TASKS 64
+/*
+ * Every task has a page directory of its own. Linear addresses below
+ * TASK_BASE are the kernel's direct mapping of physical memory (see
+ * mem_init()) and are the same in all of them; each task's code and
+ * data live at TASK_BASE, up to TASK_SIZE. The gdt in boot/head.s has
+ * room for the TSS and LDT of NR_TASKS tasks.
+ */
+#define NR_TASKS 256
+#define TASK_BASE 0x40000000
+#define TASK_SIZE 0x80000000
 #define HZ 100
 
 #define FIRST_TASK task[0]
@@ -26,8 +35,12 @@
 #define NULL ((void *) 0)
 #endif
 
-extern int copy_page_tables(unsigned long from, unsigned long to, long size);
-extern int free_page_tables(unsigned long from, unsigned long size);
+extern unsigned long new_page_dir(void);
+extern int copy_page_tables(unsigned long from, unsigned long to, long size,
+	unsigned long dir);
+extern int free_page_tables(unsigned long from, unsigned long size,
+	unsigned long dir);
+extern void vfork_release(unsigned long dir);
 
 extern void sched_init(void);
 extern void schedule(void);
@@ -77,6 +90,13 @@ struct tss_struct {
 	struct i387_struct i387;
 };
 
+struct timer_list {
+	struct timer_list * next, ** pprev;	/* pprev is NULL when idle */
+	unsigned long expires;
+	unsigned long data;
+	void (*function)(unsigned long);
+};
+
 struct task_struct {
 /* these are hardcoded - don't touch */
 	long state;	/* -1 unrunnable, 0 runnable, >0 stopped */
@@ -94,6 +114,18 @@ struct task_struct {
 	long alarm;
 	long utime,stime,cutime,cstime,start_time;
 	unsigned short used_math;
+/* scheduler state, see sched.c */
+	int nr;			/* slot in task[] */
+	long run_slot;		/* run queue bucket, -1 if not queued */
+	long epoch;		/* counter last recalculated in this epoch */
+	struct task_struct * run_next, * run_prev;
+	struct timer_list alarm_timer;
+/* set while a vfork()ed child runs in its parent's address space */
+	int vfork;
+	struct task_struct * vfork_wait;	/* the parent, waiting */
+/* mmap()ed files, see mm/mmap.c */
+	int nr_mmap;
+	struct vm_area mmap[NR_MMAP];
 /* file system info */
 	int tty;		/* -1 if no tty, so it must be signed */
 	unsigned short umask;
@@ -120,6 +152,9 @@ struct task_struct {
 /* uid etc */	0,0,0,0,0,0, \
 /* alarm */	0,0,0,0,0,0, \
 /* math */	0, \
+/* sched */	0,-1,0,NULL,NULL,{NULL,}, \
+/* vfork */	0,NULL, \
+/* mmap */	0,{{0,},}, \
 /* fs info */	-1,0022,NULL,NULL,NULL,0, \
 /* filp */	{NULL,}, \
 	{ \
@@ -136,6 +171,7 @@ struct task_struct {
 }
 
 extern struct task_struct *task[NR_TASKS];
+extern int max_tasks;
 extern struct task_struct *last_task_used_math;
 extern struct task_struct *current;
 extern long volatile jiffies;
@@ -143,10 +179,16 @@ extern long startup_time;
 
 #define CURRENT_TIME (startup_time+jiffies/HZ)
 
-extern void add_timer(long jiffies, void (*fn)(void));
+extern void add_timer(long ticks, void (*fn)(void));
+extern void start_timer(struct timer_list * timer);
+extern int del_timer(struct timer_list * timer);
 extern void sleep_on(struct task_struct ** p);
 extern void interruptible_sleep_on(struct task_struct ** p);
 extern void wake_up(struct task_struct ** p);
+extern void wake_up_process(struct task_struct * p);
+extern void signal_wakeup(struct task_struct * p);
+extern void set_alarm(struct task_struct * p, long expires);
+extern void free_task_slot(int nr, long pid);
 
 /*
  * Entry into gdt where to find first TSS. 0-nul, 1-cs, 2-ds, 3-syscall
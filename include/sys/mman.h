@@ -0,0 +1,21 @@
+#ifndef _SYS_MMAN_H
+#define _SYS_MMAN_H
+
+#include <sys/types.h>
+
+#define PROT_NONE	0
+#define PROT_READ	1
+#define PROT_WRITE	2
+#define PROT_EXEC	4
+
+#define MAP_SHARED	1	/* writes go back to the file */
+#define MAP_PRIVATE	2	/* writes stay in a copy of our own */
+#define MAP_FIXED	0x10	/* map at exactly 'addr' */
+
+#define MAP_FAILED	((void *) -1)
+
+extern void * mmap(void * addr, size_t len, int prot, int flags,
+	int fd, off_t off);
+extern int munmap(void * addr, size_t len);
+
+#endif
@@ -26,7 +26,9 @@ static inline _syscall0(int,fork)
 static inline _syscall0(int,pause)
 static inline _syscall1(int,setup,void *,BIOS)
 static inline _syscall0(int,sync)
+static inline _syscall2(int,bdflush,int,func,long,data)
 
+#include <linux/config.h>
 #include <linux/tty.h>
 #include <linux/sched.h>
 #include <linux/head.h>
@@ -114,8 +116,8 @@ void main(void)		/* This really IS void, no error here. */
  	drive_info = DRIVE_INFO;
 	memory_end = (1<<20) + (EXT_MEM_K<<10);
 	memory_end &= 0xfffff000;
-	if (memory_end > 16*1024*1024)
-		memory_end = 16*1024*1024;
+	if (memory_end > TASK_BASE)
+		memory_end = TASK_BASE;
 	if (memory_end > 12*1024*1024) 
 		buffer_memory_end = 4*1024*1024;
 	else if (memory_end > 6*1024*1024)
@@ -127,6 +129,14 @@ void main(void)		/* This really IS void, no error here. */
 	main_memory_start += rd_init(main_memory_start, RAMDISK*1024);
 #endif
 	mem_init(main_memory_start,memory_end);
+#ifdef MAX_TASKS
+	max_tasks = MAX_TASKS;
+#else
+/* allow about four pages of main memory per process */
+	max_tasks = (memory_end-main_memory_start) >> 14;
+#endif
+	if (max_tasks > NR_TASKS)
+		max_tasks = NR_TASKS;
 	trap_init();
 	blk_dev_init();
 	chr_dev_init();
@@ -134,6 +144,8 @@ void main(void)		/* This really IS void, no error here. */
 	time_init();
 	sched_init();
 	buffer_init(buffer_memory_end);
+	inode_init();
+	dcache_init();
 	hd_init();
 	floppy_init();
 	sti();
@@ -179,6 +191,11 @@ void init(void)
 	printf("%d buffers = %d bytes buffer space\n\r",NR_BUFFERS,
 		NR_BUFFERS*BLOCK_SIZE);
 	printf("Free mem: %d bytes\n\r",memory_end-main_memory_start);
+	if (!fork()) {		/* bdflush never returns unless killed */
+		close(0);close(1);close(2);
+		bdflush(0,0);
+		_exit(0);
+	}
 	if (!(pid=fork())) {
 		close(0);
 		if (open("/etc/rc",O_RDONLY,0))
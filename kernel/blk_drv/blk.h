@@ -18,11 +18,22 @@
  */
 #define NR_REQUEST	32
 
+/*
+ * Adjacent requests to a disk get merged into one, up to this many
+ * sectors (64kB). It has to fit in the 8-bit sector count of the AT
+ * controller.
+ */
+#define MAX_SECTORS	128
+
 /*
  * Ok, this is an expanded form so that we can use the same
  * request for paging requests when that is implemented. In
  * paging, 'bh' is NULL, and 'waiting' is used to wait for
  * read/write completion.
+ *
+ * A request may cover several buffers, chained through b_reqnext.
+ * 'buffer' and 'current_nr_sectors' describe the one being transferred,
+ * 'nr_sectors' what is left of the whole request.
  */
 struct request {
 	int dev;		/* -1 if no request */
@@ -30,9 +41,14 @@ struct request {
 	int errors;
 	unsigned long sector;
 	unsigned long nr_sectors;
+	unsigned long current_nr_sectors;
 	char * buffer;
 	struct task_struct * waiting;
+	int * status;		/* no bh: set to 1 when done, -1 on error */
 	struct buffer_head * bh;
+	struct buffer_head * bhtail;
+	long start_time;	/* jiffies when queued */
+	long deadline;		/* used by the deadline scheduler */
 	struct request * next;
 };
 
@@ -55,11 +71,29 @@ struct request {
 struct blk_dev_struct {
 	void (*request_fn)(void);
 	struct request * current_request;
+	struct blk_sched * sched;
+	struct request request[NR_REQUEST];
+	struct task_struct * wait_for_request;
+/* statistics, to compare the schedulers */
+	int nr_queued,max_queued;
+	unsigned long nr_done,wait_total,wait_max;
+};
+
+/*
+ * An I/O scheduler keeps the order of a device queue. add_request()
+ * gives it new requests with 'add' (the queue is never empty then),
+ * and end_request() asks 'next' what to run after the current one.
+ * Both are called with interrupts disabled.
+ */
+struct blk_sched {
+	char * name;
+	void (*add)(struct blk_dev_struct * dev, struct request * req);
+	struct request * (*next)(struct blk_dev_struct * dev);
 };
 
 extern struct blk_dev_struct blk_dev[NR_BLK_DEV];
-extern struct request request[NR_REQUEST];
-extern struct task_struct * wait_for_request;
+extern struct blk_sched elevator_sched, deadline_sched;
+extern struct request * finish_request(struct blk_dev_struct * dev);
 
 #ifdef MAJOR_NR
 
@@ -117,27 +151,44 @@ static inline void unlock_buffer(struct buffer_head * bh)
 	wake_up(&bh->b_wait);
 }
 
+/*
+ * end_request() finishes the buffer at the head of the current request.
+ * If more buffers are chained after it the request stays current, and
+ * the driver just carries on with the next one.
+ */
 static inline void end_request(int uptodate)
 {
 	/*
 	 * 此处 CURRENT 是指目前的读写请求
 	 * 这个函数是在终止这个请求
 	 */
+	struct buffer_head * bh;
 
-	DEVICE_OFF(CURRENT->dev);
-	if (CURRENT->bh) {
-		CURRENT->bh->b_uptodate = uptodate;
-		unlock_buffer(CURRENT->bh);
-	}
 	if (!uptodate) {
 		printk(DEVICE_NAME " I/O error\n\r");
 		printk("dev %04x, block %d\n\r",CURRENT->dev,
-			CURRENT->bh->b_blocknr);
+			CURRENT->bh ? CURRENT->bh->b_blocknr : 0);
+	}
+	if ((bh = CURRENT->bh)) {
+		CURRENT->bh = bh->b_reqnext;
+		bh->b_reqnext = NULL;
+		bh->b_uptodate = uptodate;
+		unlock_buffer(bh);
+		if ((bh = CURRENT->bh)) {
+			/* skip whatever is left of a failed buffer */
+			CURRENT->sector += CURRENT->current_nr_sectors;
+			CURRENT->nr_sectors -= CURRENT->current_nr_sectors;
+			CURRENT->current_nr_sectors = 2;
+			CURRENT->buffer = bh->b_data;
+			CURRENT->errors = 0;
+			return;
+		}
 	}
+	if (CURRENT->status)
+		*CURRENT->status = uptodate ? 1 : -1;
+	DEVICE_OFF(CURRENT->dev);
 	wake_up(&CURRENT->waiting);
-	wake_up(&wait_for_request);
-	CURRENT->dev = -1;
-	CURRENT = CURRENT->next;
+	CURRENT = finish_request(blk_dev+MAJOR_NR);
 }
 
 #define INIT_REQUEST \
@@ -38,6 +38,16 @@ static void recal_intr(void);
 
 static int recalibrate = 0;
 static int reset = 0;
+static int setmult = 0;		/* bitmap of drives that lost SET MULTIPLE */
+
+/*
+ * Sectors moved per interrupt with READ/WRITE MULTIPLE (0 = not used),
+ * and whether the drive does bus-master DMA.
+ */
+#define MAX_MULT	16
+static int mult_count[MAX_HD] = {0,};
+static int use_dma[MAX_HD] = {0,};
+static unsigned short bmiba = 0;	/* bus-master base, 0 if none */
 
 /*
  *  This struct defines the HD's and their types.
@@ -67,6 +77,126 @@ __asm__("cld;rep;outsw"::"d" (port),"S" (buf),"c" (nr))
 extern void hd_interrupt(void);
 extern void rd_load(void);
 
+static void hd_out(unsigned int drive,unsigned int nsect,unsigned int sect,
+		unsigned int head,unsigned int cyl,unsigned int cmd,
+		void (*intr_addr)(void));
+static int win_result(void);
+
+static volatile int polled_done;
+
+static void polled_intr(void)
+{
+	polled_done = 1;
+}
+
+/*
+ * Used only at setup time, before the drive sees any requests: issue a
+ * command and spin until its interrupt has come in.
+ */
+static int hd_polled(int drive,int nsect,int cmd,unsigned short * buf)
+{
+	int i;
+
+	polled_done = 0;
+	hd_out(drive,nsect,0,0,0,cmd,&polled_intr);
+	for (i = 0 ; i < 1000000 && !polled_done ; i++)
+		nop();
+	if (!polled_done) {
+		do_hd = NULL;
+		return -1;
+	}
+	if (buf) {
+		if (!(inb_p(HD_STATUS) & DRQ_STAT))
+			return -1;
+		port_read(HD_DATA,buf,256);
+	}
+	return win_result();
+}
+
+#ifdef HD_DMA
+#define PCI_CONF(bus,dev,fn,reg) \
+(0x80000000 | ((bus)<<16) | ((dev)<<11) | ((fn)<<8) | (reg))
+
+static unsigned long pci_read(unsigned long addr)
+{
+	outl(addr,0xCF8);
+	return inl(0xCFC);
+}
+
+static void pci_write(unsigned long addr,unsigned long val)
+{
+	outl(addr,0xCF8);
+	outl(val,0xCFC);
+}
+
+/*
+ * Look for an Intel IDE controller on bus 0 and switch on its bus-master
+ * engine. Only the primary channel is used, as that is where hd0/hd1 are.
+ */
+static void find_piix(void)
+{
+	unsigned long addr;
+	int dev,fn;
+
+	for (dev = 0 ; dev < 32 ; dev++)
+		for (fn = 0 ; fn < 8 ; fn++) {
+			if ((pci_read(PCI_CONF(0,dev,fn,0)) & 0xffff) != 0x8086)
+				continue;
+			if ((pci_read(PCI_CONF(0,dev,fn,8)) >> 16) != 0x0101)
+				continue;
+			addr = pci_read(PCI_CONF(0,dev,fn,0x20));
+			if (!(addr & 1))
+				continue;
+			bmiba = addr & 0xfffc;
+			addr = PCI_CONF(0,dev,fn,4);
+			pci_write(addr,pci_read(addr) | 5);	/* io + master */
+			return;
+		}
+}
+
+/* one entry per buffer in the request, plus the partial first one */
+static unsigned long prd_table[2*(MAX_SECTORS/2+1)]
+	__attribute__((aligned(1024)));
+#endif
+
+/*
+ * Ask the drives what they can do, and pick the fastest mode they
+ * agree to. The result is reported, as it makes a big difference.
+ */
+static void hd_setup_modes(void)
+{
+	static unsigned short id[256];
+	int drive,n;
+
+#ifdef HD_DMA
+	find_piix();
+#endif
+	for (drive = 0 ; drive < NR_HD ; drive++) {
+		if (hd_polled(drive,0,WIN_IDENTIFY,id)) {
+			printk("hd%d: IDENTIFY failed, using PIO\n\r",drive);
+			continue;
+		}
+#ifndef HD_NO_MULTIPLE
+		n = id[47] & 0xff;
+		if (n > MAX_MULT)
+			n = MAX_MULT;
+		while (n & (n-1))
+			n &= n-1;
+		if (n > 1 && !hd_polled(drive,n,WIN_SETMULT,NULL))
+			mult_count[drive] = n;
+#endif
+		if (bmiba && (id[49] & 0x100))
+			use_dma[drive] = 1;
+		if (use_dma[drive])
+			printk("hd%d: bus-master DMA\n\r",drive);
+		else if (mult_count[drive])
+			printk("hd%d: PIO, %d sectors/interrupt\n\r",drive,
+				mult_count[drive]);
+		else
+			printk("hd%d: PIO, 1 sector/interrupt\n\r",drive);
+	}
+}
+
 /* This may be used only once, enforced by 'static int callable' */
 int sys_setup(void * BIOS)
 {
@@ -153,6 +283,7 @@ int sys_setup(void * BIOS)
 	}
 	if (NR_HD)
 		printk("Partition table%s ok.\n\r",(NR_HD>1)?"s":"");
+	hd_setup_modes();
 	rd_load();
 	mount_root();
 	return (0);
@@ -247,25 +378,82 @@ static void bad_rw_intr(void)
 		reset = 1;
 }
 
+/*
+ * Number of sectors the drive moves per DRQ block for the current request.
+ */
+static inline int hd_block(void)
+{
+	int n = mult_count[CURRENT_DEV];
+
+	if (!n)
+		return 1;
+	return (n < CURRENT->nr_sectors) ? n : CURRENT->nr_sectors;
+}
+
+/*
+ * Step over 'n' finished sectors, ending buffers as they are completed.
+ * Returns the number of sectors left in the request.
+ */
+static int hd_advance(int n)
+{
+	int left = CURRENT->nr_sectors;
+
+	while (n-- > 0) {
+		CURRENT->buffer += 512;
+		CURRENT->sector++;
+		left = --CURRENT->nr_sectors;
+		if (!--CURRENT->current_nr_sectors)
+			end_request(1);
+		if (!left)
+			break;
+	}
+	return left;
+}
+
+/*
+ * Feed the drive one block of 'n' sectors. The block may run over into
+ * the following buffers of the request, but nothing is ended until the
+ * drive has acknowledged the write.
+ */
+static void hd_write_block(int n)
+{
+	struct buffer_head * bh = CURRENT->bh;
+	char * buf = CURRENT->buffer;
+	int left = CURRENT->current_nr_sectors;
+
+	while (n-- > 0) {
+		if (!left && bh && bh->b_reqnext) {
+			bh = bh->b_reqnext;
+			buf = bh->b_data;
+			left = 2;
+		}
+		port_write(HD_DATA,buf,256);
+		buf += 512;
+		left--;
+	}
+}
+
 // 异步回调
 static void read_intr(void)
 {
+	int n;
+
 	if (win_result()) {
 		bad_rw_intr();
 		do_hd_request();
 		return;
 	}
-	port_read(HD_DATA,CURRENT->buffer,256);
 	CURRENT->errors = 0;
-	CURRENT->buffer += 512;
-	CURRENT->sector++;
-	if (--CURRENT->nr_sectors) {
-		do_hd = &read_intr;
-		return;
+	n = hd_block();
+	// 因为回调已经成功，hd_advance 会调用 end_request 关闭请求
+	while (n--) {
+		port_read(HD_DATA,CURRENT->buffer,256);
+		if (!hd_advance(1)) {
+			do_hd_request();
+			return;
+		}
 	}
-	// 因为回调已经成功，所以调用 end_request 关闭请求
-	end_request(1);
-	do_hd_request();
+	do_hd = &read_intr;
 }
 
 static void write_intr(void)
@@ -275,17 +463,68 @@ static void write_intr(void)
 		do_hd_request();
 		return;
 	}
-	if (--CURRENT->nr_sectors) {
-		CURRENT->sector++;
-		CURRENT->buffer += 512;
+	CURRENT->errors = 0;
+	if (hd_advance(hd_block())) {
 		do_hd = &write_intr;
-		port_write(HD_DATA,CURRENT->buffer,256);
+		hd_write_block(hd_block());
+		return;
+	}
+	do_hd_request();
+}
+
+#ifdef HD_DMA
+/*
+ * The whole request went in one go: end every buffer in it.
+ */
+static void dma_intr(void)
+{
+	int i;
+
+	outb(inb(bmiba+BM_COMMAND) & ~BM_START,bmiba+BM_COMMAND);
+	i = inb(bmiba+BM_STATUS);
+	outb(i | BM_ERROR | BM_INTR,bmiba+BM_STATUS);
+	if (win_result() || (i & BM_ERROR)) {
+		bad_rw_intr();
+		do_hd_request();
 		return;
 	}
-	end_request(1);
+	do {
+		i = CURRENT->nr_sectors - CURRENT->current_nr_sectors;
+		CURRENT->sector += CURRENT->current_nr_sectors;
+		CURRENT->nr_sectors = i;
+		CURRENT->current_nr_sectors = 0;
+		end_request(1);
+	} while (i);
 	do_hd_request();
 }
 
+static void hd_dma(unsigned int drive,unsigned int nsect,unsigned int sec,
+		unsigned int head,unsigned int cyl)
+{
+	unsigned long * prd = prd_table;
+	struct buffer_head * bh = CURRENT->bh;
+
+	*prd++ = (unsigned long) CURRENT->buffer;
+	*prd++ = CURRENT->current_nr_sectors << 9;
+	if (bh)
+		for (bh = bh->b_reqnext ; bh ; bh = bh->b_reqnext) {
+			*prd++ = (unsigned long) bh->b_data;
+			*prd++ = BLOCK_SIZE;
+		}
+	prd[-1] |= 0x80000000;
+	outb(0,bmiba+BM_COMMAND);
+	outl((unsigned long) prd_table,bmiba+BM_PRD_ADDR);
+	outb(inb(bmiba+BM_STATUS) | BM_ERROR | BM_INTR,bmiba+BM_STATUS);
+	if (CURRENT->cmd == READ) {
+		hd_out(drive,nsect,sec,head,cyl,WIN_READDMA,&dma_intr);
+		outb(BM_READ | BM_START,bmiba+BM_COMMAND);
+	} else {
+		hd_out(drive,nsect,sec,head,cyl,WIN_WRITEDMA,&dma_intr);
+		outb(BM_START,bmiba+BM_COMMAND);
+	}
+}
+#endif
+
 static void recal_intr(void)
 {
 	if (win_result())
@@ -304,7 +543,7 @@ void do_hd_request(void)
 	INIT_REQUEST;
 	dev = MINOR(CURRENT->dev);
 	block = CURRENT->sector;
-	if (dev >= 5*NR_HD || block+2 > hd[dev].nr_sects) {
+	if (dev >= 5*NR_HD || block+CURRENT->nr_sectors > hd[dev].nr_sects) {
 		end_request(0);
 		goto repeat;
 	}
@@ -324,29 +563,48 @@ void do_hd_request(void)
 	}
 	if (recalibrate) {
 		recalibrate = 0;
+		setmult = (1<<MAX_HD)-1;
 		hd_out(dev,hd_info[CURRENT_DEV].sect,0,0,0,
 			WIN_RESTORE,&recal_intr);
 		return;
 	}	
+/* a reset drops the drive back out of multiple mode */
+	if ((setmult & (1<<dev)) && mult_count[dev]) {
+		setmult &= ~(1<<dev);
+		hd_out(dev,mult_count[dev],0,0,0,WIN_SETMULT,&recal_intr);
+		return;
+	}
+	if (CURRENT->cmd != WRITE && CURRENT->cmd != READ)
+		panic("unknown hd-command");
+#ifdef HD_DMA
+	if (use_dma[dev]) {
+		hd_dma(dev,nsect,sec,head,cyl);
+		return;
+	}
+#endif
 	if (CURRENT->cmd == WRITE) {
-		hd_out(dev,nsect,sec,head,cyl,WIN_WRITE,&write_intr);
+		hd_out(dev,nsect,sec,head,cyl,
+			mult_count[dev] ? WIN_MULTWRITE : WIN_WRITE,&write_intr);
 		for(i=0 ; i<3000 && !(r=inb_p(HD_STATUS)&DRQ_STAT) ; i++)
 			/* nothing */ ;
 		if (!r) {
 			bad_rw_intr();
 			goto repeat;
 		}
-		port_write(HD_DATA,CURRENT->buffer,256);
-	} else if (CURRENT->cmd == READ) {
+		hd_write_block(hd_block());
+	} else {
 		// 设置回调函数 read_intr 直接返回
-		hd_out(dev,nsect,sec,head,cyl,WIN_READ,&read_intr);
-	} else
-		panic("unknown hd-command");
+		hd_out(dev,nsect,sec,head,cyl,
+			mult_count[dev] ? WIN_MULTREAD : WIN_READ,&read_intr);
+	}
 }
 
 void hd_init(void)
 {
 	blk_dev[MAJOR_NR].request_fn = DEVICE_REQUEST;
+#ifdef BLK_DEADLINE
+	blk_dev[MAJOR_NR].sched = &deadline_sched;
+#endif
 	set_intr_gate(0x2E,&hd_interrupt);
 	outb_p(inb_p(0x21)&0xfb,0x21);
 	outb(inb_p(0xA1)&0xbf,0xA1);
@@ -45,18 +45,13 @@
  * to load a nr of sectors into memory
  */
 /*
- * 程序载入时设置一个长度为 NR_REQUEST 的请求项数组，此处 NR_REQUEST = 32
+ * 每个块设备有自己的长度为 NR_REQUEST 的请求项数组，此处 NR_REQUEST = 32
  */
-struct request request[NR_REQUEST];
-
-/*
- * used to wait on when there are no free requests
- */
-struct task_struct * wait_for_request = NULL;
 
 /* blk_dev_struct is:
  *	do_request-address
  *	next-request
+ *	scheduler, and the device's own request slots
  */
 /*
  * 块设备表，每种块设备都在此表中占有一项
@@ -97,6 +92,82 @@ static inline void unlock_buffer(struct buffer_head * bh)
 	wake_up(&bh->b_wait);
 }
 
+/*
+ * Expiry times of the deadline scheduler, in jiffies. Reads are what
+ * processes wait for, so they get the shorter one.
+ */
+static long read_expire = HZ/2;
+static long write_expire = 5*HZ;
+
+/*
+ * The classic one-way elevator: sorted on insertion, always served
+ * in queue order.
+ */
+static void elevator_add(struct blk_dev_struct * dev, struct request * req)
+{
+	struct request * tmp = dev->current_request;
+
+	// TODO 电梯算法：读优先，根据扇区号，设备号排序
+	for ( ; tmp->next ; tmp=tmp->next)
+		if ((IN_ORDER(tmp,req) || 
+		    !IN_ORDER(tmp,tmp->next)) &&
+		    IN_ORDER(req,tmp->next))
+			break;
+	req->next=tmp->next;
+	tmp->next=req;
+}
+
+static struct request * elevator_next(struct blk_dev_struct * dev)
+{
+	return dev->current_request->next;
+}
+
+struct blk_sched elevator_sched = { "elevator", elevator_add, elevator_next };
+
+/*
+ * The deadline scheduler sorts on sector alone, so that neither reads
+ * nor writes get to go first forever, and jumps to the oldest expired
+ * request whenever there is one.
+ */
+#define SECTOR_ORDER(s1,s2) \
+((s1)->dev < (s2)->dev || ((s1)->dev == (s2)->dev && \
+(s1)->sector < (s2)->sector))
+
+static void deadline_add(struct blk_dev_struct * dev, struct request * req)
+{
+	struct request * tmp = dev->current_request;
+
+	req->deadline = jiffies +
+		((req->cmd == READ) ? read_expire : write_expire);
+	for ( ; tmp->next ; tmp=tmp->next)
+		if ((SECTOR_ORDER(tmp,req) ||
+		    !SECTOR_ORDER(tmp,tmp->next)) &&
+		    SECTOR_ORDER(req,tmp->next))
+			break;
+	req->next=tmp->next;
+	tmp->next=req;
+}
+
+static struct request * deadline_next(struct blk_dev_struct * dev)
+{
+	struct request * head = dev->current_request;
+	struct request * req, * prev, * best = NULL, * best_prev = NULL;
+
+	for (prev = head ; (req = prev->next) ; prev = req)
+		if (jiffies - req->deadline >= 0 &&
+		    (!best || req->deadline < best->deadline)) {
+			best = req;
+			best_prev = prev;
+		}
+	if (!best || best_prev == head)
+		return head->next;
+	best_prev->next = best->next;
+	best->next = head->next;
+	return best;
+}
+
+struct blk_sched deadline_sched = { "deadline", deadline_add, deadline_next };
+
 /*
  * add-request adds a request to the linked list.
  * It disables interrupts so that it can muck with the
@@ -104,29 +175,85 @@ static inline void unlock_buffer(struct buffer_head * bh)
  */
 static void add_request(struct blk_dev_struct * dev, struct request * req)
 {
-	struct request * tmp;
-
 	req->next = NULL;
+	req->start_time = jiffies;
 	cli();
 	if (req->bh)
 		req->bh->b_dirt = 0;
+	if (++dev->nr_queued > dev->max_queued)
+		dev->max_queued = dev->nr_queued;
 	// 如果当前没有请求，直接运行 request_fn
-	if (!(tmp = dev->current_request)) {
+	if (!dev->current_request) {
 		dev->current_request = req;
 		sti();
 		// 调用设备的请求处理函数 对应块设备的 do_hd_request
 		(dev->request_fn)();
 		return;
 	}
-	// TODO 电梯算法：读优先，根据扇区号，设备号排序
-	for ( ; tmp->next ; tmp=tmp->next)
-		if ((IN_ORDER(tmp,req) || 
-		    !IN_ORDER(tmp,tmp->next)) &&
-		    IN_ORDER(req,tmp->next))
-			break;
-	req->next=tmp->next;
-	tmp->next=req;
+	dev->sched->add(dev,req);
+	sti();
+}
+
+/*
+ * Called by end_request() (from the interrupt) when the current request
+ * is done: account for it, free its slot and pick the next one.
+ */
+struct request * finish_request(struct blk_dev_struct * dev)
+{
+	struct request * req = dev->current_request;
+	unsigned long wait = jiffies - req->start_time;
+
+	dev->nr_queued--;
+	dev->nr_done++;
+	dev->wait_total += wait;
+	if (wait > dev->wait_max)
+		dev->wait_max = wait;
+	req->dev = -1;
+	wake_up(&dev->wait_for_request);
+	return dev->sched->next(dev);
+}
+
+/*
+ * Try to tack the buffer onto a queued request for the adjacent sectors,
+ * either at the back or at the front. The first request in the queue is
+ * already being worked on by the driver, so it is left alone. Only the
+ * hard disk knows how to handle buffer chains.
+ */
+static int attempt_merge(int major,int rw,struct buffer_head * bh)
+{
+	struct request * req;
+	unsigned long sector = bh->b_blocknr<<1;
+
+	if (major != 3)
+		return 0;
+	cli();
+	if (!(req = blk_dev[major].current_request)) {
+		sti();
+		return 0;
+	}
+	while ((req = req->next)) {
+		if (req->dev != bh->b_dev || req->cmd != rw || !req->bh)
+			continue;
+		if (req->nr_sectors + 2 > MAX_SECTORS)
+			continue;
+		if (req->sector + req->nr_sectors == sector) {
+			req->bhtail->b_reqnext = bh;
+			req->bhtail = bh;
+		} else if (req->sector == sector + 2) {
+			bh->b_reqnext = req->bh;
+			req->bh = bh;
+			req->buffer = bh->b_data;
+			req->current_nr_sectors = 2;
+			req->sector = sector;
+		} else
+			continue;
+		req->nr_sectors += 2;
+		bh->b_dirt = 0;
+		sti();
+		return 1;
+	}
 	sti();
+	return 0;
 }
 
 /*
@@ -155,25 +282,27 @@ static void make_request(int major,int rw, struct buffer_head * bh)
 		return;
 	}
 repeat:
+	if (attempt_merge(major,rw,bh))
+		return;
 /* we don't allow the write-requests to fill up the queue completely:
  * we want some room for reads: they take precedence. The last third
  * of the requests are only for reads.
  */
 	if (rw == READ)
-		req = request+NR_REQUEST;
+		req = blk_dev[major].request+NR_REQUEST;
 	else
-		req = request+((NR_REQUEST*2)/3);
+		req = blk_dev[major].request+((NR_REQUEST*2)/3);
 /* find an empty request */
-	while (--req >= request)
+	while (--req >= blk_dev[major].request)
 		if (req->dev<0)
 			break;
 /* if none found, sleep on new requests: check for rw_ahead */
-	if (req < request) {
+	if (req < blk_dev[major].request) {
 		if (rw_ahead) {
 			unlock_buffer(bh);
 			return;
 		}
-		sleep_on(&wait_for_request);
+		sleep_on(&blk_dev[major].wait_for_request);
 		goto repeat;
 	}
 /* fill up the request-info, and add it to the queue */
@@ -182,9 +311,12 @@ repeat:
 	req->errors=0;
 	req->sector = bh->b_blocknr<<1;
 	req->nr_sectors = 2;
+	req->current_nr_sectors = 2;
 	req->buffer = bh->b_data;
 	req->waiting = NULL;
+	req->status = NULL;
 	req->bh = bh;
+	req->bhtail = bh;
 	req->next = NULL;
 	add_request(major+blk_dev,req);
 }
@@ -209,6 +341,58 @@ void ll_rw_block(int rw, struct buffer_head * bh)
 	make_request(major,rw,bh);
 }
 
+/*
+ * Read or write the whole page 'page' of device 'dev' (page 0 being its
+ * first 8 sectors) into/from 'buffer', for swapping. This bypasses the
+ * buffer cache: the request has no buffer head, and we sleep until
+ * end_request() has set 'status'. The request may be done before we get
+ * to sleep (the ramdisk does it at once), and is gone by the time we
+ * wake. Only drivers that handle more than a block per request (ramdisk
+ * and hard disk) can do this. Returns 0, or -EIO if it failed.
+ */
+int ll_rw_page(int rw, int dev, int page, char * buffer)
+{
+	struct request * req;
+	unsigned int major = MAJOR(dev);
+	volatile int status = 0;
+
+	if (major >= NR_BLK_DEV || !(blk_dev[major].request_fn)) {
+		printk("Trying to read nonexistent block-device\n\r");
+		return -EIO;
+	}
+	if (rw!=READ && rw!=WRITE)
+		panic("Bad block dev command, must be R/W");
+repeat:
+	req = blk_dev[major].request+NR_REQUEST;
+	while (--req >= blk_dev[major].request)
+		if (req->dev<0)
+			break;
+	if (req < blk_dev[major].request) {
+		sleep_on(&blk_dev[major].wait_for_request);
+		goto repeat;
+	}
+	req->dev = dev;
+	req->cmd = rw;
+	req->errors = 0;
+	req->sector = page<<3;
+	req->nr_sectors = 8;
+	req->current_nr_sectors = 8;
+	req->buffer = buffer;
+	req->waiting = current;
+	req->status = (int *) &status;
+	req->bh = NULL;
+	req->bhtail = NULL;
+	req->next = NULL;
+	add_request(major+blk_dev,req);
+	cli();
+	while (!status) {
+		current->state = TASK_UNINTERRUPTIBLE;
+		schedule();
+	}
+	sti();
+	return (status < 0) ? -EIO : 0;
+}
+
 /*
  * 在内核初始化时，init/main.c 程序调用了该函数，用于初始化所有块设备。
  * dev 为使用的设备号，-1 代表空闲
@@ -216,10 +400,28 @@ void ll_rw_block(int rw, struct buffer_head * bh)
  */
 void blk_dev_init(void)
 {
+	int i,j;
+
+	for (j=0 ; j<NR_BLK_DEV ; j++) {
+		blk_dev[j].sched = &elevator_sched;
+		for (i=0 ; i<NR_REQUEST ; i++) {
+			blk_dev[j].request[i].dev = -1;
+			blk_dev[j].request[i].next = NULL;
+		}
+	}
+}
+
+void show_blk_stat(void)
+{
+	struct blk_dev_struct * dev;
 	int i;
 
-	for (i=0 ; i<NR_REQUEST ; i++) {
-		request[i].dev = -1;
-		request[i].next = NULL;
+	for (i=0,dev=blk_dev ; i<NR_BLK_DEV ; i++,dev++) {
+		if (!dev->request_fn || !dev->nr_done)
+			continue;
+		printk("blk %d (%s): %d queued, max %d, %d done, "
+			"wait avg %d max %d ticks\n\r",i,dev->sched->name,
+			dev->nr_queued,dev->max_queued,dev->nr_done,
+			dev->wait_total/dev->nr_done,dev->wait_max);
 	}
 }
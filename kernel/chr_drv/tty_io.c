@@ -115,8 +115,10 @@ void tty_intr(struct tty_struct * tty, int mask)
 	if (tty->pgrp <= 0)
 		return;
 	for (i=0;i<NR_TASKS;i++)
-		if (task[i] && task[i]->pgrp==tty->pgrp)
+		if (task[i] && task[i]->pgrp==tty->pgrp) {
 			task[i]->signal |= mask;
+			signal_wakeup(task[i]);
+		}
 }
 
 static void sleep_if_empty(struct tty_queue * queue)
@@ -242,7 +244,7 @@ int tty_read(unsigned channel, char * buf, int nr)
 	if (time && !minimum) {
 		minimum=1;
 		if ((flag=(!oldalarm || time+jiffies<oldalarm)))
-			current->alarm = time+jiffies;
+			set_alarm(current,time+jiffies);
 	}
 	if (minimum>nr)
 		minimum=nr;
@@ -272,9 +274,9 @@ int tty_read(unsigned channel, char * buf, int nr)
 		} while (nr>0 && !EMPTY(tty->secondary));
 		if (time && !L_CANON(tty)) {
 			if ((flag=(!oldalarm || time+jiffies<oldalarm)))
-				current->alarm = time+jiffies;
+				set_alarm(current,time+jiffies);
 			else
-				current->alarm = oldalarm;
+				set_alarm(current,oldalarm);
 		}
 		if (L_CANON(tty)) {
 			if (b-buf)
@@ -282,7 +284,7 @@ int tty_read(unsigned channel, char * buf, int nr)
 		} else if (b-buf >= minimum)
 			break;
 	}
-	current->alarm = oldalarm;
+	set_alarm(current,oldalarm);
 	if (current->signal && !(b-buf))
 		return -EINTR;
 	return (b-buf);
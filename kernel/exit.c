@@ -18,27 +18,24 @@ int sys_close(int fd);
 
 void release(struct task_struct * p)
 {
-	int i;
-
 	if (!p)
 		return;
-	for (i=1 ; i<NR_TASKS ; i++)
-		if (task[i]==p) {
-			task[i]=NULL;
-			free_page((long)p);
-			schedule();
-			return;
-		}
-	panic("trying to release non-existent task");
+	if (!p->nr || task[p->nr] != p)
+		panic("trying to release non-existent task");
+	free_task_slot(p->nr,p->pid);
+	free_page(p->tss.cr3);
+	free_page((long)p);
+	schedule();
 }
 
 static inline int send_sig(long sig,struct task_struct * p,int priv)
 {
 	if (!p || sig<1 || sig>32)
 		return -EINVAL;
-	if (priv || (current->euid==p->euid) || suser())
+	if (priv || (current->euid==p->euid) || suser()) {
 		p->signal |= (1<<(sig-1));
-	else
+		signal_wakeup(p);
+	} else
 		return -EPERM;
 	return 0;
 }
@@ -48,8 +45,10 @@ static void kill_session(void)
 	struct task_struct **p = NR_TASKS + task;
 	// 循环所有进程，给 session 一致的所有进程发送 SIGHUP
 	while (--p > &FIRST_TASK) {
-		if (*p && (*p)->session == current->session)
+		if (*p && (*p)->session == current->session) {
 			(*p)->signal |= 1<<(SIGHUP-1);
+			signal_wakeup(*p);
+		}
 	}
 }
 
@@ -98,6 +97,7 @@ static void tell_father(int pid)
 			if (task[i]->pid != pid)
 				continue;
 			task[i]->signal |= (1<<(SIGCHLD-1));
+			signal_wakeup(task[i]);
 			return;
 		}
 /* if we don't find any fathers, we just release ourselves */
@@ -112,8 +112,14 @@ int do_exit(long code)
 {
 	int i;
 	// TODO 待看页表
-	free_page_tables(get_base(current->ldt[1]),get_limit(0x0f));
-	free_page_tables(get_base(current->ldt[2]),get_limit(0x17));
+	if (current->vfork)
+		vfork_release((unsigned long) pg_dir);
+	else {
+		exit_mmap();
+		free_page_tables(get_base(current->ldt[1]),get_limit(0x0f),current->tss.cr3);
+		free_page_tables(get_base(current->ldt[2]),get_limit(0x17),current->tss.cr3);
+	}
+	set_alarm(current,0);
 	/*
 	 * 找出所有子进程，将它们的父亲设为 init 进程，将状态标记为僵尸
 	 * 然后给 init 进程发送一个 SIGCHLD 信号，提醒 init 进程回收子进程
@@ -20,7 +20,19 @@
 
 extern void write_verify(unsigned long address);
 
+/*
+ * Pids come from a bitmap and are handed out in increasing order from
+ * last_pid, so a pid is not reused straight away. Released task slots
+ * are kept on a stack; slots from next_slot up have never been used.
+ * No more than max_tasks slots are in use at a time, task 0's included.
+ */
+#define PID_MAX 0x8000
+
 long last_pid=0;
+int max_tasks=NR_TASKS;
+static unsigned long pid_map[PID_MAX/32] = {1,};
+static int free_slot[NR_TASKS];
+static int nr_free_slots=0, next_slot=1;
 
 void verify_area(void * addr,int size)
 {
@@ -50,24 +62,45 @@ int copy_mem(int nr,struct task_struct * p)
 		panic("We don't support separate I&D");
 	if (data_limit < code_limit)
 		panic("Bad data_limit");
-	new_data_base = new_code_base = nr * 0x4000000;
+	new_data_base = new_code_base = TASK_BASE;
 	p->start_code = new_code_base;
 	set_base(p->ldt[1],new_code_base);
 	set_base(p->ldt[2],new_data_base);
-	if (copy_page_tables(old_data_base,new_data_base,data_limit)) {
+	if (!(p->tss.cr3 = new_page_dir()))
+		return -ENOMEM;
+	if (copy_page_tables(old_data_base,new_data_base,data_limit,p->tss.cr3)) {
 		printk("free_page_tables: from copy_mem\n");
-		free_page_tables(new_data_base,data_limit);
+		free_page_tables(new_data_base,data_limit,p->tss.cr3);
+		free_page(p->tss.cr3);
 		return -ENOMEM;
 	}
 	return 0;
 }
 
+/*
+ * A vfork()ed child gives its parent's address space back when it execs
+ * or exits, and goes on with the page directory 'dir'.
+ */
+void vfork_release(unsigned long dir)
+{
+	current->tss.cr3 = dir;
+	__asm__("movl %%eax,%%cr3"::"a" (dir));
+	current->vfork = 0;
+	current->nr_mmap = 0;	/* those were the parent's */
+	wake_up(&current->vfork_wait);
+}
+
 /*
  *  Ok, this is the main fork-routine. It copies the system process
  * information (task[nr]) and sets up the necessary registers. It
  * also copies the data segment in it's entirety.
+ *
+ * With 'vfork' set nothing is copied: the child runs on our page
+ * directory, and we sleep until it execs or exits (vfork_release()).
+ * Task 0 has no address space of the usual shape to lend, so it always
+ * gets a real fork.
  */
-int copy_process(int nr,long ebp,long edi,long esi,long gs,long none,
+int copy_process(long vfork,int nr,long ebp,long edi,long esi,long gs,long none,
 		long ebx,long ecx,long edx,
 		long fs,long es,long ds,
 		long eip,long cs,long eflags,long esp,long ss)
@@ -75,21 +108,32 @@ int copy_process(int nr,long ebp,long edi,long esi,long gs,long none,
 	struct task_struct *p;
 	int i;
 	struct file *f;
+	long pid = last_pid;	/* find_empty_process() just got us this one */
 
 	p = (struct task_struct *) get_free_page();
-	if (!p)
+	if (!p) {
+		free_task_slot(nr,pid);
 		return -EAGAIN;
+	}
 	task[nr] = p;
 	
 	// NOTE!: the following statement now work with gcc 4.3.2 now, and you
 	// must compile _THIS_ memcpy without no -O of gcc.#ifndef GCC4_3
 	*p = *current;	/* NOTE! this doesn't copy the supervisor stack */
 	p->state = TASK_UNINTERRUPTIBLE;
-	p->pid = last_pid;
+	p->tss.cr3 = 0;		/* nothing for swap_out() to look at yet */
+	p->pid = pid;
 	p->father = current->pid;
 	p->counter = p->priority;
 	p->signal = 0;
 	p->alarm = 0;
+	p->alarm_timer.next = NULL;
+	p->alarm_timer.pprev = NULL;
+	p->nr = nr;
+	p->run_slot = -1;
+	p->run_next = p->run_prev = NULL;
+	p->vfork = vfork && current->nr;
+	p->vfork_wait = NULL;
 	p->leader = 0;		/* process leadership doesn't inherit */
 	p->utime = p->stime = 0;
 	p->cutime = p->cstime = 0;
@@ -117,8 +161,10 @@ int copy_process(int nr,long ebp,long edi,long esi,long gs,long none,
 	p->tss.trace_bitmap = 0x80000000;
 	if (last_task_used_math == current)
 		__asm__("clts ; fnsave %0"::"m" (p->tss.i387));
-	if (copy_mem(nr,p)) {
-		task[nr] = NULL;
+	if (p->vfork)
+		p->tss.cr3 = current->tss.cr3;
+	else if (copy_mem(nr,p)) {
+		free_task_slot(nr,pid);
 		free_page((long) p);
 		return -EAGAIN;
 	}
@@ -131,22 +177,76 @@ int copy_process(int nr,long ebp,long edi,long esi,long gs,long none,
 		current->root->i_count++;
 	if (current->executable)
 		current->executable->i_count++;
+	if (!p->vfork)
+		for (i=0; i<p->nr_mmap; i++)
+			get_vma(p->mmap + i);
 	set_tss_desc(gdt+(nr<<1)+FIRST_TSS_ENTRY,&(p->tss));
 	set_ldt_desc(gdt+(nr<<1)+FIRST_LDT_ENTRY,&(p->ldt));
-	p->state = TASK_RUNNING;	/* do this last, just in case */
-	return last_pid;
+	wake_up_process(p);	/* do this last, just in case */
+	while (p->vfork)
+		sleep_on(&p->vfork_wait);
+	return pid;
 }
 
-int find_empty_process(void)
+static long alloc_pid(void)
 {
-	int i;
+	unsigned long bits;
+	long pid = last_pid+1;
+	int i, n;
 
-	repeat:
-		if ((++last_pid)<0) last_pid=1;
-		for(i=0 ; i<NR_TASKS ; i++)
-			if (task[i] && task[i]->pid == last_pid) goto repeat;
-	for(i=1 ; i<NR_TASKS ; i++)
-		if (!task[i])
-			return i;
+	for (n=0 ; n<=PID_MAX/32 ; n++) {
+		if (pid >= PID_MAX)
+			pid = 1;
+		i = pid >> 5;
+		bits = ~pid_map[i] & (~0UL << (pid & 31));
+		if (bits) {
+			__asm__("bsfl %1,%0":"=r" (pid):"rm" (bits));
+			pid += i << 5;
+			pid_map[i] |= 1UL << (pid & 31);
+			return last_pid = pid;
+		}
+		pid = (i+1) << 5;
+	}
 	return -EAGAIN;
 }
+
+int find_empty_process(void)
+{
+	int nr;
+
+	if (next_slot - nr_free_slots >= max_tasks)
+		return -EAGAIN;
+	if (nr_free_slots)
+		nr = free_slot[--nr_free_slots];
+	else
+		nr = next_slot++;
+	if (alloc_pid() < 0) {
+		free_slot[nr_free_slots++] = nr;
+		return -EAGAIN;
+	}
+	return nr;
+}
+
+void free_task_slot(int nr, long pid)
+{
+	task[nr] = NULL;
+	free_slot[nr_free_slots++] = nr;
+	pid_map[pid >> 5] &= ~(1UL << (pid & 31));
+}
+
+/*
+ * Set the process limit to 'nr', if it is positive. Tasks already there
+ * are left alone, but no more are made while they are over it. Returns
+ * the limit.
+ */
+int sys_maxtasks(int nr)
+{
+	if (nr > 0) {
+		if (!suser())
+			return -EPERM;
+		if (nr < 2 || nr > NR_TASKS)
+			return -EINVAL;
+		max_tasks = nr;
+	}
+	return max_tasks;
+}
@@ -37,6 +37,8 @@ void math_emulate(long edi, long esi, long ebp, long sys_call_ret,
 void math_error(void)
 {
 	__asm__("fnclex");
-	if (last_task_used_math)
+	if (last_task_used_math) {
 		last_task_used_math->signal |= 1<<(SIGFPE-1);
+		signal_wakeup(last_task_used_math);
+	}
 }
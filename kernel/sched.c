@@ -34,15 +34,6 @@ void show_task(int nr,struct task_struct * p)
 	printk("%d (of %d) chars free in kernel stack\n\r",i,j);
 }
 
-void show_stat(void)
-{
-	int i;
-
-	for (i=0;i<NR_TASKS;i++)
-		if (task[i])
-			show_task(i,task[i]);
-}
-
 #define LATCH (1193180/HZ)
 
 extern void mem_use(void);
@@ -92,10 +83,117 @@ void math_state_restore()
 }
 
 /*
- *  'schedule()' is the scheduler function. This is GOOD CODE! There
- * probably won't be any reason to change this, as it should work well
- * in all circumstances (ie gives IO-bound processes good response etc).
- * The one thing you might take a look at is the signal-handler code here.
+ * Runnable tasks live on run queues instead of being found by scanning
+ * task[]. rq[0] holds the tasks that still have time left, in buckets
+ * indexed by their counter; rq[1] holds the ones that have used up their
+ * slice, bucketed by the counter they will get next. A bitmap per queue
+ * makes picking the highest non-empty bucket a bsrl.
+ *
+ * When rq[0] runs dry a new epoch starts: the expired tasks get
+ * counter = counter/2 + priority and move back. Sleeping tasks are not
+ * touched then; enqueue_task() catches their counter up with the epochs
+ * they slept through when they wake, which gives the same result as the
+ * old recalculation over every task.
+ *
+ * The current task stays on its queue while it is runnable. Task 0 is
+ * never queued: it runs when both queues are empty.
+ */
+#define NR_RUNQ 64
+#define MIN(a,b) (((a)<(b))?(a):(b))
+
+static struct run_queue {
+	unsigned long bitmap[NR_RUNQ/32];
+	struct task_struct * head[NR_RUNQ];
+	int nr;
+} rq[2];
+
+static long sched_epoch = 0;
+static long nr_switches = 0;
+
+static inline int find_last_bit(unsigned long * map)
+{
+	int i, bit;
+
+	for (i = NR_RUNQ/32-1 ; i >= 0 ; i--)
+		if (map[i]) {
+			__asm__("bsrl %1,%0":"=r" (bit):"rm" (map[i]));
+			return i*32+bit;
+		}
+	return -1;
+}
+
+static void enqueue_task(struct task_struct * p)
+{
+	struct run_queue * q = rq;
+	struct task_struct ** head;
+	long n;
+
+	for (n = sched_epoch - p->epoch ; n > 0 ; n--)
+		if (p->counter == (p->counter >> 1) + p->priority)
+			break;
+		else
+			p->counter = (p->counter >> 1) + p->priority;
+	p->epoch = sched_epoch;
+	if (p->counter > 0)
+		n = MIN(p->counter,NR_RUNQ-1);
+	else {
+		q++;
+		n = MIN(p->priority,NR_RUNQ-1);
+	}
+	head = q->head + n;
+	if (!*head) {
+		*head = p->run_next = p->run_prev = p;
+		q->bitmap[n >> 5] |= 1 << (n & 31);
+	} else {
+		p->run_next = *head;
+		p->run_prev = (*head)->run_prev;
+		p->run_prev->run_next = p;
+		(*head)->run_prev = p;
+	}
+	q->nr++;
+	p->run_slot = (q - rq)*NR_RUNQ + n;
+}
+
+static void dequeue_task(struct task_struct * p)
+{
+	struct run_queue * q;
+	int n;
+
+	if (p->run_slot < 0)
+		return;
+	q = rq + p->run_slot / NR_RUNQ;
+	n = p->run_slot % NR_RUNQ;
+	if (p->run_next == p) {
+		q->head[n] = NULL;
+		q->bitmap[n >> 5] &= ~(1 << (n & 31));
+	} else {
+		p->run_prev->run_next = p->run_next;
+		p->run_next->run_prev = p->run_prev;
+		if (q->head[n] == p)
+			q->head[n] = p->run_next;
+	}
+	p->run_next = p->run_prev = NULL;
+	p->run_slot = -1;
+	q->nr--;
+}
+
+static void new_epoch(void)
+{
+	struct task_struct * p;
+	int n;
+
+	sched_epoch++;
+	while ((n = find_last_bit(rq[1].bitmap)) >= 0) {
+		p = rq[1].head[n];
+		dequeue_task(p);
+		enqueue_task(p);
+	}
+}
+
+/*
+ *  'schedule()' is the scheduler function. It picks the runnable task
+ * with the largest counter, as it always has, but does so from the run
+ * queues above rather than by looking at every task.
  *
  *   NOTE!!  Task 0 is the 'idle' task, which gets called when no other
  * tasks can run. It can not be killed, and it cannot sleep. The 'state'
@@ -103,53 +201,47 @@ void math_state_restore()
  */
 void schedule(void)
 {
-	int i,next,c;
-	struct task_struct ** p;
-
-/* check alarm, wake up any interruptible tasks that have got a signal */
-	// jiffies 是系统开机开始算起的滴答数 默认 10ms 一滴答
-	// 检查报警定时值 alarm，如果有进程的 alarm 已经过期，则给进程设置 SIGALRM
-	// 同时重置 alarm
-	for(p = &LAST_TASK ; p > &FIRST_TASK ; --p)
-		if (*p) {
-			if ((*p)->alarm && (*p)->alarm < jiffies) {
-					(*p)->signal |= (1<<(SIGALRM-1));
-					(*p)->alarm = 0;
-				}
-			// 如果信号中除去可以被阻塞的信号还有别的信号并且进程是可中断的睡眠状态
-			// 则标记该进程为就绪状态
-			if (((*p)->signal & ~(_BLOCKABLE & (*p)->blocked)) &&
-			(*p)->state==TASK_INTERRUPTIBLE)
-				(*p)->state=TASK_RUNNING;
-		}
+	struct task_struct * next;
+	unsigned long flags;
 
-/* this is the scheduler proper: */
-
-	while (1) {
-		c = -1;
-		next = 0;
-		i = NR_TASKS;
-		p = &task[NR_TASKS];
-		while (--i) {
-			if (!*--p)
-				continue;
-			// 依次循环所有就绪进程，找出剩余时间片最大的进程
-			if ((*p)->state == TASK_RUNNING && (*p)->counter > c)
-				c = (*p)->counter, next = i;
-		}
-		// 如果找到最大时间片非零，则直接调度给这个进程
-		if (c) break;
-		for(p = &LAST_TASK ; p > &FIRST_TASK ; --p)
-			// 当没有进程有有效时间片时，开始按照优先级给所有进程分配时间片
-			if (*p)
-				// TODO
-				(*p)->counter = ((*p)->counter >> 1) +
-						(*p)->priority;
+	save_flags(flags);
+	cli();
+	if (current->state != TASK_RUNNING) {
+/* a signal that arrived before we got here must not be slept through */
+		if (current->state == TASK_INTERRUPTIBLE &&
+		    (current->signal & ~(_BLOCKABLE & current->blocked)))
+			current->state = TASK_RUNNING;
+		else
+			dequeue_task(current);
 	}
-	// 如果重新分配时间片，这里 next 为 0，而 0 是一个空闲 idle 进程
-	// 会调用 pause() 将自己设置为可中断状态并调用 schedule()
+	if (!rq[0].nr && rq[1].nr)
+		new_epoch();
+	if (rq[0].nr)
+		next = rq[0].head[find_last_bit(rq[0].bitmap)];
+	else
+		next = task[0];
+	if (next != current)
+		nr_switches++;
+	switch_to(next->nr);
+	restore_flags(flags);
+}
 
-	switch_to(next);
+void show_stat(void)
+{
+	int i;
+
+	for (i=0;i<NR_TASKS;i++)
+		if (task[i])
+			show_task(i,task[i]);
+	printk("run queues: %d active, %d expired, %d switches\n\r",
+		rq[0].nr,rq[1].nr,nr_switches);
+	show_blk_stat();
+	show_buffer_stat();
+	show_inode_stat();
+	show_dcache_stat();
+	show_bitmap_stat();
+	calc_mem();
+	show_swap_stat();
 }
 
 // 将自己设置为可中断状态，然后调用 schedule()
@@ -157,6 +249,10 @@ int sys_pause(void)
 {
 	current->state = TASK_INTERRUPTIBLE;
 	schedule();
+/* task 0 only gets here when nobody else can run: clear free pages */
+	if (!current->nr)
+		while (!rq[0].nr && !rq[1].nr && zero_idle_page())
+			/* nothing */;
 	return 0;
 }
 
@@ -194,8 +290,7 @@ void sleep_on(struct task_struct **p)
 	 * 所以模拟了一个队列。
 	 */
 	if (tmp)
-		// TASK_RUNNING = 0
-		tmp->state=0;
+		wake_up_process(tmp);
 }
 
 void interruptible_sleep_on(struct task_struct **p)
@@ -211,22 +306,50 @@ void interruptible_sleep_on(struct task_struct **p)
 repeat:	current->state = TASK_INTERRUPTIBLE;
 	schedule();
 	if (*p && *p != current) {
-		(**p).state=0;
+		wake_up_process(*p);
 		goto repeat;
 	}
 	*p=NULL;
 	if (tmp)
-		tmp->state=0;
+		wake_up_process(tmp);
 }
 
 void wake_up(struct task_struct **p)
 {
 	if (p && *p) {
-		(**p).state=0;
+		wake_up_process(*p);
 		*p=NULL;
 	}
 }
 
+/*
+ * Make p runnable. Safe from interrupts; waking a task that is already
+ * runnable is harmless.
+ */
+void wake_up_process(struct task_struct * p)
+{
+	unsigned long flags;
+
+	save_flags(flags);
+	cli();
+	p->state = TASK_RUNNING;
+	if (p->run_slot < 0 && p != task[0])
+		enqueue_task(p);
+	restore_flags(flags);
+}
+
+/*
+ * Called after posting a signal to p: an interruptible sleeper is woken
+ * if the signal is not blocked. This used to be done by schedule()
+ * looking at every task on every call.
+ */
+void signal_wakeup(struct task_struct * p)
+{
+	if (p->state == TASK_INTERRUPTIBLE &&
+	    (p->signal & ~(_BLOCKABLE & p->blocked)))
+		wake_up_process(p);
+}
+
 /*
  * OK, here are some floppy things that shouldn't be in the kernel
  * proper. They are here because the floppy needs a timer, and this
@@ -295,45 +418,167 @@ void do_floppy_timer(void)
 	}
 }
 
-#define TIME_REQUESTS 64
+/*
+ * Timers live on a hierarchical wheel: tv1 has a slot for each of the
+ * next 256 ticks, and each of the four tvn levels has 64 slots covering
+ * 64 times the range of the level below. Adding and deleting a timer
+ * is O(1). Every 256 ticks a slot of the next level is cascaded down,
+ * so do_timer() only ever runs the timers in one tv1 slot.
+ */
+#define TVN_BITS 6
+#define TVR_BITS 8
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVR_MASK (TVR_SIZE - 1)
+
+static struct timer_list * tv1[TVR_SIZE];
+static struct timer_list * tvn[4][TVN_SIZE];
+static unsigned long timer_jiffies = 0;
+static struct timer_list * free_timers = NULL;
+
+static void internal_add_timer(struct timer_list * timer)
+{
+	unsigned long expires = timer->expires;
+	unsigned long idx = expires - timer_jiffies;
+	struct timer_list ** head;
+	int i;
+
+	if ((long) idx < 0)
+		head = tv1 + (timer_jiffies & TVR_MASK);
+	else if (idx < TVR_SIZE)
+		head = tv1 + (expires & TVR_MASK);
+	else {
+		for (i = 0 ; i < 3 ; i++)
+			if (idx < 1UL << (TVR_BITS + (i+1)*TVN_BITS))
+				break;
+		head = tvn[i] + ((expires >> (TVR_BITS + i*TVN_BITS)) & TVN_MASK);
+	}
+	if ((timer->next = *head))
+		timer->next->pprev = &timer->next;
+	*head = timer;
+	timer->pprev = head;
+}
+
+void start_timer(struct timer_list * timer)
+{
+	unsigned long flags;
 
-static struct timer_list {
-	long jiffies;
-	void (*fn)();
-	struct timer_list * next;
-} timer_list[TIME_REQUESTS], * next_timer = NULL;
+	save_flags(flags);
+	cli();
+	if (timer->pprev)
+		panic("start_timer: timer already pending");
+	internal_add_timer(timer);
+	restore_flags(flags);
+}
 
-void add_timer(long jiffies, void (*fn)(void))
+/*
+ * Returns 1 if the timer was pending, 0 if it had already run or was
+ * never started.
+ */
+int del_timer(struct timer_list * timer)
+{
+	unsigned long flags;
+	int ret = 0;
+
+	save_flags(flags);
+	cli();
+	if (timer->pprev) {
+		if ((*timer->pprev = timer->next))
+			timer->next->pprev = timer->pprev;
+		timer->next = NULL;
+		timer->pprev = NULL;
+		ret = 1;
+	}
+	restore_flags(flags);
+	return ret;
+}
+
+static void cascade_timers(struct timer_list ** head)
+{
+	struct timer_list * timer;
+
+	while ((timer = *head)) {
+		if ((*head = timer->next))
+			(*head)->pprev = head;
+		internal_add_timer(timer);
+	}
+}
+
+/*
+ * add_timer() is the old interface: run fn in 'ticks' ticks. Its
+ * timers come from a pool that grows a page at a time, so unlike the
+ * old fixed table of 64 it cannot run out while there is memory.
+ */
+static void pool_timer(unsigned long fn)
+{
+	((void (*)(void)) fn)();
+}
+
+static void run_timers(void)
+{
+	struct timer_list * timer, ** head;
+	void (*fn)(unsigned long);
+	unsigned long data;
+	int i;
+
+	while ((long) (jiffies - timer_jiffies) >= 0) {
+		for (i = 0 ; i < 4 ; i++) {
+			unsigned long n = timer_jiffies >> (TVR_BITS + i*TVN_BITS);
+
+			if (timer_jiffies & ((1UL << (TVR_BITS + i*TVN_BITS))-1))
+				break;
+			cascade_timers(tvn[i] + (n & TVN_MASK));
+		}
+		head = tv1 + (timer_jiffies & TVR_MASK);
+		while ((timer = *head)) {
+			if ((*head = timer->next))
+				(*head)->pprev = head;
+			timer->next = NULL;
+			timer->pprev = NULL;
+			fn = timer->function;
+			data = timer->data;
+			if (fn == pool_timer) {
+				timer->next = free_timers;
+				free_timers = timer;
+			}
+			fn(data);
+		}
+		timer_jiffies++;
+	}
+}
+
+void add_timer(long ticks, void (*fn)(void))
 {
 	struct timer_list * p;
+	unsigned long flags;
+	int i;
 
 	if (!fn)
 		return;
+	save_flags(flags);
 	cli();
-	if (jiffies <= 0)
+	if (ticks <= 0)
 		(fn)();
 	else {
-		for (p = timer_list ; p < timer_list + TIME_REQUESTS ; p++)
-			if (!p->fn)
-				break;
-		if (p >= timer_list + TIME_REQUESTS)
-			panic("No more time requests free");
-		p->fn = fn;
-		p->jiffies = jiffies;
-		p->next = next_timer;
-		next_timer = p;
-		while (p->next && p->next->jiffies < p->jiffies) {
-			p->jiffies -= p->next->jiffies;
-			fn = p->fn;
-			p->fn = p->next->fn;
-			p->next->fn = fn;
-			jiffies = p->jiffies;
-			p->jiffies = p->next->jiffies;
-			p->next->jiffies = jiffies;
-			p = p->next;
+		if (!free_timers) {
+			if (!(p = (struct timer_list *) get_free_page()))
+				panic("No memory for time requests");
+			for (i = PAGE_SIZE/sizeof(*p) ; i-- ; p++) {
+				p->next = free_timers;
+				free_timers = p;
+			}
 		}
+		p = free_timers;
+		free_timers = p->next;
+		p->expires = jiffies + ticks;
+		p->data = (unsigned long) fn;
+		p->function = pool_timer;
+		p->next = NULL;
+		p->pprev = NULL;
+		internal_add_timer(p);
 	}
-	sti();
+	restore_flags(flags);
 }
 
 void do_timer(long cpl)
@@ -350,32 +595,59 @@ void do_timer(long cpl)
 	else
 		current->stime++;
 
-	if (next_timer) {
-		next_timer->jiffies--;
-		while (next_timer && next_timer->jiffies <= 0) {
-			void (*fn)(void);
-			
-			fn = next_timer->fn;
-			next_timer->fn = NULL;
-			next_timer = next_timer->next;
-			(fn)();
-		}
-	}
+	run_timers();
 	if (current_DOR & 0xf0)
 		do_floppy_timer();
-	if ((--current->counter)>0) return;
+/* move the current task to the bucket for its new counter */
+	if ((--current->counter)>0) {
+		if (current->run_slot >= 0 && current->run_slot < NR_RUNQ &&
+		    current->run_slot != MIN(current->counter,NR_RUNQ-1)) {
+			dequeue_task(current);
+			enqueue_task(current);
+		}
+		return;
+	}
 	current->counter=0;
+	if (current->run_slot >= 0 && current->run_slot < NR_RUNQ) {
+		dequeue_task(current);
+		enqueue_task(current);
+	}
 	if (!cpl) return;
 	schedule();
 }
 
+static void alarm_timeout(unsigned long data)
+{
+	struct task_struct * p = (struct task_struct *) data;
+
+	p->alarm = 0;
+	p->signal |= (1<<(SIGALRM-1));
+	signal_wakeup(p);
+}
+
+/*
+ * Arm p's alarm for tick 'expires' on the timer wheel, or cancel it if
+ * 'expires' is 0.
+ */
+void set_alarm(struct task_struct * p, long expires)
+{
+	del_timer(&p->alarm_timer);
+	p->alarm = expires;
+	if (expires) {
+		p->alarm_timer.expires = expires;
+		p->alarm_timer.data = (unsigned long) p;
+		p->alarm_timer.function = alarm_timeout;
+		start_timer(&p->alarm_timer);
+	}
+}
+
 int sys_alarm(long seconds)
 {
 	int old = current->alarm;
 
 	if (old)
 		old = (old - jiffies) / HZ;
-	current->alarm = (seconds>0)?(jiffies+HZ*seconds):0;
+	set_alarm(current,(seconds>0)?(jiffies+HZ*seconds):0);
 	return (old);
 }
 
@@ -21,14 +21,17 @@
  */
 
 #include <signal.h>
+#include <sys/mman.h>
 
 #include <asm/system.h>
 
+#include <linux/config.h>
 #include <linux/sched.h>
 #include <linux/head.h>
 #include <linux/kernel.h>
 
 void do_exit(long code);
+void do_no_page(unsigned long error_code,unsigned long address);
 
 static inline void oom(void)
 {
@@ -36,50 +39,267 @@ static inline void oom(void)
 	do_exit(SIGSEGV);
 }
 
-#define invalidate() \
-__asm__("movl %%eax,%%cr3"::"a" (0))
-
-/* these are not to be changed without changing head.s etc */
-#define LOW_MEM 0x100000
-#define PAGING_MEMORY (15*1024*1024)
-#define PAGING_PAGES (PAGING_MEMORY>>12)
-#define MAP_NR(addr) (((addr)-LOW_MEM)>>12)
-#define USED 100
-
 #define CODE_SPACE(addr) ((((addr)+4095)&~4095) < \
 current->start_code + current->end_code)
 
-static long HIGH_MEMORY = 0;
+long HIGH_MEMORY = 0;
 
 #define copy_page(from,to) \
 __asm__("cld ; rep ; movsl"::"S" (from),"D" (to),"c" (1024))
 
-static unsigned char mem_map [ PAGING_PAGES ] = {0,};
+/*
+ * Pages above LOW_MEM are handed out by a buddy allocator. mem_map[]
+ * still holds each page's reference count (USED for pages that are not
+ * ours to give out). A free block of 2^order pages is on
+ * free_area[order], linked through its first page, and free_order[]
+ * holds order+1 for that first page so freeing can find its buddy.
+ * Both arrays are sized for the actual memory in mem_init().
+ */
+#define MAX_ORDER 8
+
+struct page_block {
+	struct page_block * next, * prev;
+};
+
+unsigned char * mem_map;
+static unsigned char * free_order;
+static struct page_block * free_area[MAX_ORDER];
+static long nr_pages = 0;
+static long nr_free_pages = 0;
+
+#define BLOCK(nr) ((struct page_block *) (LOW_MEM + ((nr) << 12)))
+
+static inline void add_free(unsigned long nr, int order)
+{
+	struct page_block * b = BLOCK(nr);
+
+	b->prev = NULL;
+	if ((b->next = free_area[order]))
+		b->next->prev = b;
+	free_area[order] = b;
+	free_order[nr] = order+1;
+}
+
+static inline void del_free(unsigned long nr, int order)
+{
+	struct page_block * b = BLOCK(nr);
+
+	if (b->next)
+		b->next->prev = b->prev;
+	if (b->prev)
+		b->prev->next = b->next;
+	else
+		free_area[order] = b->next;
+	free_order[nr] = 0;
+}
+
+/* must be called with interrupts off */
+static void release_block(unsigned long nr, int order)
+{
+	unsigned long buddy;
+
+	nr_free_pages += 1 << order;
+	for ( ; order < MAX_ORDER-1 ; order++) {
+		buddy = nr ^ (1 << order);
+		if (buddy >= nr_pages || free_order[buddy] != order+1)
+			break;
+		del_free(buddy,order);
+		nr &= ~(1 << order);
+	}
+	add_free(nr,order);
+}
+
+#define zero_pages(addr,order) \
+__asm__("cld ; rep ; stosl"::"a" (0),"D" (addr),"c" (1024 << (order)):"memory")
+
+/*
+ * Pages are handed out either zeroed or "dirty" (old contents left in
+ * place) for callers that overwrite the whole page anyway. The idle task
+ * clears free pages ahead of time into zero_pool[], so that most zeroed
+ * single-page requests need no clearing at all. Pool pages count as used
+ * in mem_map[]; they go back to the buddy lists if memory runs short.
+ */
+#define ZERO_POOL 32
+
+static unsigned long zero_pool[ZERO_POOL];
+static int nr_zeroed = 0;
+
+static int shrink_page_cache(int nr);
 
 /*
- * Get physical address of first (actually last :-) free page, and mark it
- * used. If no free pages left, return 0.
+ * Allocation latency in cycles, as log2 buckets, for each kind of
+ * request: zeroed from the pool, zeroed on demand, and dirty.
  */
+#define LAT_POOL	0
+#define LAT_CLEAR	1
+#define LAT_DIRTY	2
+#define NR_LAT_BUCKETS	20
+
+#ifdef ALLOC_STATS
+static unsigned long alloc_lat[3][NR_LAT_BUCKETS];
+
+#define rdtscl(low) \
+__asm__ __volatile__("rdtsc":"=a" (low)::"edx")
+
+static inline void account_alloc(int kind, unsigned long start)
+{
+	unsigned long now;
+	int bucket = 0;
+
+	rdtscl(now);
+	if ((now -= start))
+		__asm__("bsrl %1,%0":"=r" (bucket):"rm" (now));
+	if (bucket >= NR_LAT_BUCKETS)
+		bucket = NR_LAT_BUCKETS-1;
+	alloc_lat[kind][bucket]++;
+}
+#else
+#define rdtscl(low) ((void) 0)
+#define account_alloc(kind,start) ((void) 0)
+#endif
+
+/*
+ * Take 2^order free pages off the buddy lists, without clearing them.
+ * If there is no large enough block, the zero pool and then unmapped
+ * page cache pages are given back and we try again. Returns the
+ * physical address, or 0.
+ */
+static unsigned long alloc_pages(int order)
+{
+	unsigned long flags, nr;
+	int i;
+
+	if (order < 0 || order >= MAX_ORDER)
+		return 0;
+	save_flags(flags);
+	cli();
+repeat:
+	for (i = order ; i < MAX_ORDER ; i++)
+		if (free_area[i])
+			break;
+	if (i >= MAX_ORDER) {
+		if (nr_zeroed) {
+			while (nr_zeroed) {
+				nr = MAP_NR(zero_pool[--nr_zeroed]);
+				mem_map[nr] = 0;
+				release_block(nr,0);
+			}
+			goto repeat;
+		}
+		if (shrink_page_cache(1 << order))
+			goto repeat;
+		restore_flags(flags);
+		return 0;
+	}
+	nr = MAP_NR((unsigned long) free_area[i]);
+	del_free(nr,i);
+	while (i > order) {
+		i--;
+		add_free(nr + (1 << i),i);
+	}
+	nr_free_pages -= 1 << order;
+	for (i = 0 ; i < 1 << order ; i++)
+		mem_map[nr+i] = 1;
+	restore_flags(flags);
+	return LOW_MEM + (nr << 12);
+}
+
+/*
+ * Get the physical address of 2^order free, zeroed and physically
+ * contiguous pages, aligned to their size, and mark them used. Returns
+ * 0 if there is no such block.
+ */
+unsigned long get_free_pages(int order)
+{
+	unsigned long flags, start, addr = 0;
+
+	rdtscl(start);
+	if (!order) {
+		save_flags(flags);
+		cli();
+		if (nr_zeroed)
+			addr = zero_pool[--nr_zeroed];
+		restore_flags(flags);
+		if (addr) {
+			account_alloc(LAT_POOL,start);
+			return addr;
+		}
+	}
+	if (!(addr = alloc_pages(order)))
+		return 0;
+	zero_pages(addr,order);
+	account_alloc(LAT_CLEAR,start);
+	return addr;
+}
+
 unsigned long get_free_page(void)
 {
-register unsigned long __res asm("ax");
+	return get_free_pages(0);
+}
 
-__asm__("std ; repne ; scasb\n\t"
-	"jne 1f\n\t"
-	"movb $1,1(%%edi)\n\t"
-	"sall $12,%%ecx\n\t"
-	"addl %2,%%ecx\n\t"
-	"movl %%ecx,%%edx\n\t"
-	"movl $1024,%%ecx\n\t"
-	"leal 4092(%%edx),%%edi\n\t"
-	"rep ; stosl\n\t"
-	" movl %%edx,%%eax\n"
-	"1: cld"
-	:"=a" (__res)
-	:"0" (0),"i" (LOW_MEM),"c" (PAGING_PAGES),
-	"D" (mem_map+PAGING_PAGES-1)
-	);
-return __res;
+/*
+ * Get a page whose contents are undefined. Only for callers that fill
+ * every byte of it before anybody can look.
+ */
+unsigned long get_dirty_page(void)
+{
+	unsigned long start, addr;
+
+	rdtscl(start);
+	if ((addr = alloc_pages(0)))
+		account_alloc(LAT_DIRTY,start);
+	return addr;
+}
+
+/*
+ * The same for callers that may sleep (page faults, fork, exec): when
+ * memory is short, pages are pushed out to swap until one is free.
+ * They only fail if nothing more can be swapped out.
+ */
+unsigned long get_free_page_wait(void)
+{
+	unsigned long addr;
+
+	while (!(addr = get_free_page()) && swap_out())
+		/* nothing */;
+	return addr;
+}
+
+unsigned long get_dirty_page_wait(void)
+{
+	unsigned long addr;
+
+	while (!(addr = get_dirty_page()) && swap_out())
+		/* nothing */;
+	return addr;
+}
+
+/*
+ * Called by the idle task: clear one free page into the zero pool.
+ * Returns 0 if there was nothing (more) to do. A reserve of free pages
+ * is left alone so that the pool never takes the last of memory.
+ */
+int zero_idle_page(void)
+{
+	unsigned long flags, addr;
+
+	if (nr_zeroed >= ZERO_POOL || nr_free_pages < 2*ZERO_POOL)
+		return 0;
+	if (!(addr = alloc_pages(0)))
+		return 0;
+	zero_pages(addr,0);
+	save_flags(flags);
+	cli();
+	if (nr_zeroed < ZERO_POOL) {
+		zero_pool[nr_zeroed++] = addr;
+		addr = 0;
+	}
+	restore_flags(flags);
+	if (addr) {
+		free_page(addr);
+		return 0;
+	}
+	return 1;
 }
 
 /*
@@ -88,45 +308,99 @@ return __res;
  */
 void free_page(unsigned long addr)
 {
+	unsigned long flags;
+
 	if (addr < LOW_MEM) return;
 	if (addr >= HIGH_MEMORY)
 		panic("trying to free nonexistent page");
-	addr -= LOW_MEM;
-	addr >>= 12;
-	if (mem_map[addr]--) return;
-	mem_map[addr]=0;
-	panic("trying to free free page");
+	addr = MAP_NR(addr);
+	if (!mem_map[addr])
+		panic("trying to free free page");
+	save_flags(flags);
+	cli();
+	if (!--mem_map[addr])
+		release_block(addr,0);
+	restore_flags(flags);
 }
 
 /*
- * This function frees a continuos block of page tables, as needed
- * by 'exit()'. As does copy_page_tables(), this handles only 4Mb blocks.
+ * Free a block from get_free_pages(). Its pages must not have been
+ * shared.
  */
-int free_page_tables(unsigned long from,unsigned long size)
+void free_pages(unsigned long addr, int order)
+{
+	unsigned long flags;
+	int i;
+
+	if (addr < LOW_MEM || addr >= HIGH_MEMORY)
+		panic("trying to free nonexistent pages");
+	addr = MAP_NR(addr);
+	if (addr & ((1 << order)-1))
+		panic("free_pages: misaligned block");
+	for (i = 0 ; i < 1 << order ; i++)
+		if (mem_map[addr+i] != 1)
+			panic("free_pages: page free or shared");
+	save_flags(flags);
+	cli();
+	for (i = 0 ; i < 1 << order ; i++)
+		mem_map[addr+i] = 0;
+	release_block(addr,order);
+	restore_flags(flags);
+}
+
+/*
+ * Get a page directory for a new task, with the kernel mapped.
+ */
+unsigned long new_page_dir(void)
+{
+	unsigned long dir;
+	int i;
+
+	if (!(dir = get_free_page_wait()))
+		return 0;
+	for (i = 0 ; i < (TASK_BASE >> 22) ; i++)
+		((unsigned long *) dir)[i] = pg_dir[i];
+	return dir;
+}
+
+/*
+ * This function frees a continuos block of page tables in the page
+ * directory 'dir_page', as needed by 'exit()'. As does
+ * copy_page_tables(), this handles only 4Mb blocks.
+ */
+int free_page_tables(unsigned long from,unsigned long size,unsigned long dir_page)
 {
 	unsigned long *pg_table;
 	unsigned long * dir, nr;
 
 	if (from & 0x3fffff)
 		panic("free_page_tables called with wrong alignment");
-	if (!from)
+	if (from < TASK_BASE)
 		panic("Trying to free up swapper memory space");
 	size = (size + 0x3fffff) >> 22;
-	dir = (unsigned long *) ((from>>20) & 0xffc); /* _pg_dir = 0 */
+	dir = dir_entry(dir_page,from);
 	for ( ; size-->0 ; dir++) {
 		if (!(1 & *dir))
 			continue;
 		pg_table = (unsigned long *) (0xfffff000 & *dir);
+		if (mem_map[MAP_NR((unsigned long) pg_table)] > 1) {
+			free_page((unsigned long) pg_table);
+			*dir = 0;
+			continue;
+		}
 		for (nr=0 ; nr<1024 ; nr++) {
 			if (1 & *pg_table)
 				free_page(0xfffff000 & *pg_table);
+			else if (*pg_table)
+				swap_free(*pg_table);
 			*pg_table = 0;
 			pg_table++;
 		}
 		free_page(0xfffff000 & *dir);
 		*dir = 0;
 	}
-	invalidate();
+	if (dir_page == current->tss.cr3)
+		invalidate();
 	return 0;
 }
 
@@ -137,7 +411,15 @@ int free_page_tables(unsigned long from,unsigned long size)
  *
  * Note! We don't copy just any chunks of memory - addresses have to
  * be divisible by 4Mb (one page-directory entry), as this makes the
- * function easier. It's used only by fork anyway.
+ * function easier. It's used only by fork anyway: 'from' is in the
+ * current task, 'to' in the child's page directory 'dir_page'.
+ *
+ * When from==to (any fork but the first) the page tables themselves
+ * are not copied: both directories point at the same table, read-only,
+ * and mem_map[] counts the table's users. The first one to change it
+ * gets a copy of its own, see unshare_page_table(). So fork() costs one
+ * directory entry per 4Mb in use, and exec() right after throws away
+ * only the child's references.
  *
  * NOTE 2!! When from==0 we are copying kernel space for the first
  * fork(). Then we DONT want to copy a full page-directory entry, as
@@ -147,7 +429,8 @@ int free_page_tables(unsigned long from,unsigned long size)
  * 1 Mb-range, so the pages can be shared with the kernel. Thus the
  * special case for nr=xxxx.
  */
-int copy_page_tables(unsigned long from,unsigned long to,long size)
+int copy_page_tables(unsigned long from,unsigned long to,long size,
+	unsigned long dir_page)
 {
 	unsigned long * from_page_table;
 	unsigned long * to_page_table;
@@ -159,16 +442,22 @@ int copy_page_tables(unsigned long from,unsigned long to,long size)
 		panic("copy_page_tables called with wrong alignment");
 	// 为了取得地址：先右移 22，后左移 2 位
 	// 或者 右移 20 位
-	from_dir = (unsigned long *) ((from>>20) & 0xffc); /* _pg_dir = 0 */
-	to_dir = (unsigned long *) ((to>>20) & 0xffc);
+	from_dir = cur_dir_entry(from);
+	to_dir = dir_entry(dir_page,to);
 	size = ((unsigned) (size+0x3fffff)) >> 22;
 	for( ; size-->0 ; from_dir++,to_dir++) {
 		if (1 & *to_dir)
 			panic("copy_page_tables: already exist");
 		if (!(1 & *from_dir))
 			continue;
+		if (from == to) {
+			*from_dir &= ~2;
+			*to_dir = *from_dir;
+			mem_map[MAP_NR(0xfffff000 & *from_dir)]++;
+			continue;
+		}
 		from_page_table = (unsigned long *) (0xfffff000 & *from_dir);
-		if (!(to_page_table = (unsigned long *) get_free_page()))
+		if (!(to_page_table = (unsigned long *) get_free_page_wait()))
 			return -1;	/* Out of memory, see freeing */
 		*to_dir = ((unsigned long) to_page_table) | 7;
 		nr = (from==0)?0xA0:1024;
@@ -190,6 +479,78 @@ int copy_page_tables(unsigned long from,unsigned long to,long size)
 	return 0;
 }
 
+/*
+ * Make the page table behind the directory entry 'dir' of the current
+ * task its own before it is changed. A table shared since fork() is
+ * copied, and the pages in it get a reference for each table, so they
+ * are write-protected in both (as do swapped out pages, in the swap
+ * map). If we turn out to be the last user, the
+ * entry is just made writable again. Returns 0 if out of memory.
+ */
+static int unshare_page_table(unsigned long * dir)
+{
+	unsigned long old, new, page, * from, * to;
+	int i;
+
+	if ((*dir & 3) != 1)
+		return 1;
+	old = 0xfffff000 & *dir;
+	if (mem_map[MAP_NR(old)] == 1) {
+		*dir |= 2;
+		invalidate();
+		return 1;
+	}
+	if (!(new = get_dirty_page_wait()))
+		return 0;
+	if ((*dir & 3) != 1 || old != (0xfffff000 & *dir) ||
+	    mem_map[MAP_NR(old)] == 1) {
+		free_page(new);		/* changed while we slept */
+		return unshare_page_table(dir);
+	}
+	from = (unsigned long *) old;
+	to = (unsigned long *) new;
+	for (i = 0 ; i < 1024 ; i++) {
+		page = from[i];
+		if (page & 1) {
+			page &= ~2;
+			from[i] = page;
+			if (page > LOW_MEM)
+				mem_map[MAP_NR(0xfffff000 & page)]++;
+		} else if (page)
+			swap_duplicate(page);
+		to[i] = page;
+	}
+	mem_map[MAP_NR(old)]--;
+	*dir = new | 7;
+	invalidate();
+	return 1;
+}
+
+/*
+ * Get the page table that maps 'address' in the current task, ready to
+ * be written to: private, and allocated if there was none. Returns
+ * NULL if out of memory.
+ */
+static unsigned long * get_page_table(unsigned long address)
+{
+	unsigned long tmp, * dir;
+
+	dir = cur_dir_entry(address);
+	if (*dir & 1) {
+		if (!unshare_page_table(dir))
+			return NULL;
+		return (unsigned long *) (0xfffff000 & *dir);
+	}
+	if (!(tmp = get_free_page_wait()))
+		return NULL;
+	if (*dir & 1) {
+		free_page(tmp);
+		return get_page_table(address);
+	}
+	*dir = tmp | 7;
+	return (unsigned long *) tmp;
+}
+
 /*
  * This function puts a page in memory at the wanted address.
  * It returns the physical address of the page gotten, 0 if
@@ -198,23 +559,14 @@ int copy_page_tables(unsigned long from,unsigned long to,long size)
  */
 unsigned long put_page(unsigned long page,unsigned long address)
 {
-	unsigned long tmp, *page_table;
-
-/* NOTE !!! This uses the fact that _pg_dir=0 */
+	unsigned long *page_table;
 
 	if (page < LOW_MEM || page >= HIGH_MEMORY)
 		printk("Trying to put page %p at %p\n",page,address);
 	if (mem_map[(page-LOW_MEM)>>12] != 1)
 		printk("mem_map disagrees with %p at %p\n",page,address);
-	page_table = (unsigned long *) ((address>>20) & 0xffc);
-	if ((*page_table)&1)
-		page_table = (unsigned long *) (0xfffff000 & *page_table);
-	else {
-		if (!(tmp=get_free_page()))
-			return 0;
-		*page_table = tmp|7;
-		page_table = (unsigned long *) tmp;
-	}
+	if (!(page_table = get_page_table(address)))
+		return 0;
 	page_table[(address>>12) & 0x3ff] = page | 7;
 /* no need for invalidate */
 	return page;
@@ -222,16 +574,25 @@ unsigned long put_page(unsigned long page,unsigned long address)
 
 void un_wp_page(unsigned long * table_entry)
 {
-	unsigned long old_page,new_page;
+	unsigned long old_entry,old_page,new_page;
 
-	old_page = 0xfffff000 & *table_entry;
+repeat:
+	old_entry = *table_entry;
+	old_page = 0xfffff000 & old_entry;
 	if (old_page >= LOW_MEM && mem_map[MAP_NR(old_page)]==1) {
 		*table_entry |= 2;
 		invalidate();
 		return;
 	}
-	if (!(new_page=get_free_page()))
+	if (!(new_page=get_dirty_page_wait()))
 		oom();
+/* swapping may have slept: the page can be gone, or ours alone now */
+	if (*table_entry != old_entry) {
+		free_page(new_page);
+		if (!(*table_entry & 1))
+			return;
+		goto repeat;
+	}
 	if (old_page >= LOW_MEM)
 		mem_map[MAP_NR(old_page)]--;
 	*table_entry = new_page | 7;
@@ -239,191 +600,569 @@ void un_wp_page(unsigned long * table_entry)
 	copy_page(old_page,new_page);
 }	
 
+/*
+ * Make the present page behind 'table_entry' writable for a write to
+ * 'address'. In a shared writable mapping that is the page itself,
+ * anywhere else the task gets a copy.
+ */
+static void make_writable(unsigned long * table_entry, unsigned long address)
+{
+	struct vm_area * vma = find_vma(address - current->start_code);
+
+	if (vma && (vma->flags & MAP_SHARED) && (vma->prot & PROT_WRITE)) {
+		*table_entry |= 2;
+		invalidate();
+		return;
+	}
+	un_wp_page(table_entry);
+}
+
 /*
  * This routine handles present pages, when users try to write
  * to a shared page. It is done by copying the page to a new address
  * and decrementing the shared-page counter for the old page.
  *
- * If it's in code space we exit with a segment error.
+ * If it's in code space we exit with a segment error, as we do for a
+ * mapping without PROT_WRITE.
  */
 void do_wp_page(unsigned long error_code,unsigned long address)
 {
+	unsigned long * table;
+	struct vm_area * vma;
+
 #if 0
 /* we cannot do this yet: the estdio library writes to code space */
 /* stupid, stupid. I really want the libc.a from GNU */
 	if (CODE_SPACE(address))
 		do_exit(SIGSEGV);
 #endif
-	un_wp_page((unsigned long *)
-		(((address>>10) & 0xffc) + (0xfffff000 &
-		*((unsigned long *) ((address>>20) &0xffc)))));
-
+	vma = find_vma(address - current->start_code);
+	if (vma && !(vma->prot & PROT_WRITE))
+		do_exit(SIGSEGV);
+	if (!unshare_page_table(cur_dir_entry(address)))
+		oom();
+	table = (unsigned long *) (((address>>10) & 0xffc) + (0xfffff000 &
+		*cur_dir_entry(address)));
+	if (!(*table & 2))
+		make_writable(table,address);
 }
 
+/*
+ * The kernel writes to user space without regard to write protection,
+ * so verify_area() has the pages it is going to write made writable
+ * first. Pages of a mapping are brought in for this, as the kernel
+ * would otherwise write to the page cache's own page, and a mapping
+ * without PROT_WRITE gets a segment error, as for a write by the task.
+ */
 void write_verify(unsigned long address)
 {
 	unsigned long page;
+	struct vm_area * vma = find_vma(address - current->start_code);
 
-	if (!( (page = *((unsigned long *) ((address>>20) & 0xffc)) )&1))
+	if (vma) {
+		if (!(vma->prot & PROT_WRITE))
+			do_exit(SIGSEGV);
+		page = *cur_dir_entry(address);
+		if (!(page & 1) || !(1 & ((unsigned long *)
+		    (0xfffff000 & page))[(address>>12) & 0x3ff]))
+			do_no_page(2,address);
+	}
+	if (!( (page = *cur_dir_entry(address)) &1))
 		return;
-	page &= 0xfffff000;
+	if (!unshare_page_table(cur_dir_entry(address)))
+		oom();
+	page = 0xfffff000 & *cur_dir_entry(address);
 	page += ((address>>10) & 0xffc);
 	if ((3 & *(unsigned long *) page) == 1)  /* non-writeable, present */
-		un_wp_page((unsigned long *) page);
+		make_writable((unsigned long *) page,address);
 	return;
 }
 
+/*
+ * Lend the page behind the current task's data address 'addr' to the
+ * kernel, as pipe writes do to avoid a copy. The page gets an extra
+ * reference and is write-protected, so a later write by the task
+ * copies it as with any shared page. Returns the physical page, or 0
+ * if it isn't present, isn't an ordinary paged page, or its page table
+ * is still shared after fork().
+ */
+unsigned long lend_user_page(unsigned long addr)
+{
+	unsigned long *table, page;
+
+	addr += get_base(current->ldt[2]);
+	table = cur_dir_entry(addr);
+	if ((*table & 3) != 3)
+		return 0;
+	table = (unsigned long *) (0xfffff000 & *table) + ((addr>>12) & 0x3ff);
+	if (!(*table & 1))
+		return 0;
+	page = 0xfffff000 & *table;
+	if (page < LOW_MEM || page >= HIGH_MEMORY)
+		return 0;
+	if (mem_map[MAP_NR(page)] >= USED)
+		return 0;
+	mem_map[MAP_NR(page)]++;
+	*table &= ~2;
+	invalidate();
+	return page;
+}
+
 void get_empty_page(unsigned long address)
 {
 	unsigned long tmp;
 
-	if (!(tmp=get_free_page()) || !put_page(tmp,address)) {
+	if (!(tmp=get_free_page_wait()) || !put_page(tmp,address)) {
 		free_page(tmp);		/* 0 is ok - ignored */
 		oom();
 	}
 }
 
 /*
- * try_to_share() checks the page at address "address" in the task "p",
- * to see if it exists, and if it is clean. If so, share it with the current
- * task.
+ * Executable and mmap()ed pages are kept in a page cache keyed by
+ * (device, inode, first file block), so that a fault on a page that any
+ * process has read before is served from memory. Page n of an
+ * executable starts at block 1+4n (the first block is the a.out
+ * header) and has everything past end_data cleared; mapped pages start
+ * at a multiple of four blocks and have everything past the end of the
+ * file cleared, so the two never meet. The cache holds one reference to
+ * each of its pages. They are mapped read-only except in shared
+ * writable mappings, so writes to them otherwise get a private copy
+ * through un_wp_page() as before.
  *
- * NOTE! This assumes we have checked that p != current, and that they
- * share the same executable.
- */
-static int try_to_share(unsigned long address, struct task_struct * p)
-{
-	unsigned long from;
-	unsigned long to;
-	unsigned long from_page;
-	unsigned long to_page;
-	unsigned long phys_addr;
-
-	from_page = to_page = ((address>>20) & 0xffc);
-	from_page += ((p->start_code>>20) & 0xffc);
-	to_page += ((current->start_code>>20) & 0xffc);
-/* is there a page-directory at from? */
-	from = *(unsigned long *) from_page;
-	if (!(from & 1))
-		return 0;
-	from &= 0xfffff000;
-	from_page = from + ((address>>10) & 0xffc);
-	phys_addr = *(unsigned long *) from_page;
-/* is the page clean and present? */
-	if ((phys_addr & 0x41) != 0x01)
-		return 0;
-	phys_addr &= 0xfffff000;
-	if (phys_addr >= HIGH_MEMORY || phys_addr < LOW_MEM)
-		return 0;
-	to = *(unsigned long *) to_page;
-	if (!(to & 1)) {
-		if ((to = get_free_page()))
-			*(unsigned long *) to_page = to | 7;
-		else
-			oom();
+ * Entries come from a table sized in mem_init(). When it is full, or
+ * memory runs out, pages that nobody else maps are dropped. Each entry
+ * points at its inode, which counts its cached pages in i_cached: they
+ * are dropped before the inode is used for anything else, so the
+ * inode stays in memory for as long as it has pages here.
+ */
+#define NR_PAGE_HASH 256
+#define FAULT_AROUND 8		/* pages, must be a power of two */
+
+struct cache_page {
+	unsigned short dev, ino;
+	struct m_inode * inode;
+	unsigned long block;
+	unsigned long page;
+	struct cache_page * next;
+};
+
+static struct cache_page * page_hash[NR_PAGE_HASH];
+static struct cache_page * cache_pages;
+static struct cache_page * free_cache_pages = NULL;
+static long nr_cache_pages = 0;
+static long cache_hand = 0;
+static long nr_cached = 0;
+static long nr_cache_hits = 0, nr_cache_misses = 0, nr_around = 0;
+
+#define page_hashfn(dev,ino,block) \
+	((((dev) ^ (ino)) * 0x9E3779B1U + ((block) >> 2)) & (NR_PAGE_HASH-1))
+
+/* must be called with interrupts off */
+static void drop_cache_page(struct cache_page * c)
+{
+	struct cache_page ** p;
+
+	p = page_hash + page_hashfn(c->dev,c->ino,c->block);
+	while (*p != c)
+		p = &(*p)->next;
+	*p = c->next;
+	c->inode->i_cached--;
+	free_page(c->page);
+	c->page = 0;
+	c->next = free_cache_pages;
+	free_cache_pages = c;
+	nr_cached--;
+}
+
+/*
+ * Drop up to 'nr' cached pages that are not mapped anywhere, going
+ * round the entry table like a clock. Interrupts must be off. Returns
+ * the number of pages given back.
+ */
+static int shrink_page_cache(int nr)
+{
+	struct cache_page * c;
+	int i, freed = 0;
+
+	for (i = 0 ; i < nr_cache_pages && freed < nr ; i++) {
+		c = cache_pages + cache_hand;
+		if (++cache_hand >= nr_cache_pages)
+			cache_hand = 0;
+		if (c->page && mem_map[MAP_NR(c->page)] == 1) {
+			drop_cache_page(c);
+			freed++;
+		}
 	}
-	to &= 0xfffff000;
-	to_page = to + ((address>>10) & 0xffc);
-	if (1 & *(unsigned long *) to_page)
-		panic("try_to_share: to_page already exists");
-/* share them: write-protect */
-	*(unsigned long *) from_page &= ~2;
-	*(unsigned long *) to_page = *(unsigned long *) from_page;
-	invalidate();
-	phys_addr -= LOW_MEM;
-	phys_addr >>= 12;
-	mem_map[phys_addr]++;
-	return 1;
+	return freed;
 }
 
 /*
- * share_page() tries to find a process that could share a page with
- * the current one. Address is the address of the wanted page relative
- * to the current data space.
- *
- * We first check if it is at all feasible by checking executable->i_count.
- * It should be >1 if there are other tasks sharing this inode.
+ * Look up a cached page. If it is there, it gets an extra reference
+ * for the caller and its address is returned.
  */
-static int share_page(unsigned long address)
+static unsigned long find_cached_page(struct m_inode * inode,
+	unsigned long block)
 {
-	struct task_struct ** p;
+	struct cache_page * c;
+	unsigned long flags, page = 0;
 
-	if (!current->executable)
+	save_flags(flags);
+	cli();
+	for (c = page_hash[page_hashfn(inode->i_dev,inode->i_num,block)] ;
+	     c ; c = c->next)
+		if (c->block == block && c->ino == inode->i_num &&
+		    c->dev == inode->i_dev) {
+			page = c->page;
+			mem_map[MAP_NR(page)]++;
+			break;
+		}
+	restore_flags(flags);
+	return page;
+}
+
+/*
+ * Put a freshly read page in the cache. If somebody else got there
+ * first while we slept, ours is freed and theirs returned instead (with
+ * a reference for the caller). Returns 0 if there was no entry free.
+ */
+static unsigned long add_cached_page(struct m_inode * inode,
+	unsigned long block, unsigned long page)
+{
+	struct cache_page * c;
+	unsigned long flags, old;
+
+	if ((old = find_cached_page(inode,block))) {
+		free_page(page);
+		return old;
+	}
+	save_flags(flags);
+	cli();
+	if (!free_cache_pages)
+		shrink_page_cache(1);
+	if (!(c = free_cache_pages)) {
+		restore_flags(flags);
 		return 0;
-	if (current->executable->i_count < 2)
+	}
+	free_cache_pages = c->next;
+	c->dev = inode->i_dev;
+	c->ino = inode->i_num;
+	c->inode = inode;
+	inode->i_cached++;
+	c->block = block;
+	c->page = page;
+	c->next = page_hash[page_hashfn(c->dev,c->ino,block)];
+	page_hash[page_hashfn(c->dev,c->ino,block)] = c;
+	mem_map[MAP_NR(page)]++;
+	nr_cached++;
+	restore_flags(flags);
+	return page;
+}
+
+/*
+ * Throw out cached pages of a file that are affected by a write to
+ * bytes pos..pos+count-1 of it. A write to the first block may change
+ * an executable's layout, so it drops the whole file, as does a
+ * negative count. Files with nothing cached cost nothing.
+ */
+void invalidate_file_pages(struct m_inode * inode, long pos, long count)
+{
+	struct cache_page * c, * next;
+	unsigned long flags, from, to;
+	int i;
+
+	if (!inode->i_cached)
+		return;
+	if (count < 0 || pos < BLOCK_SIZE) {
+		from = 0;
+		to = 0xffffffff;
+	} else {
+		from = pos/BLOCK_SIZE;
+		from = (from > 3) ? from - 3 : 0;
+		to = (pos + count - 1)/BLOCK_SIZE + 1;
+	}
+	save_flags(flags);
+	cli();
+	for (i = 0 ; i < NR_PAGE_HASH && inode->i_cached ; i++)
+		for (c = page_hash[i] ; c ; c = next) {
+			next = c->next;
+			if (c->inode == inode && c->block >= from && c->block < to)
+				drop_cache_page(c);
+		}
+	restore_flags(flags);
+}
+
+/* Throw out all cached pages of a device that has gone away. */
+void invalidate_dev_pages(int dev)
+{
+	struct cache_page * c, * next;
+	unsigned long flags;
+	int i;
+
+	save_flags(flags);
+	cli();
+	for (i = 0 ; i < NR_PAGE_HASH ; i++)
+		for (c = page_hash[i] ; c ; c = next) {
+			next = c->next;
+			if (c->dev == dev)
+				drop_cache_page(c);
+		}
+	restore_flags(flags);
+}
+
+/*
+ * Map a page that is shared with the cache at 'address', read-only
+ * unless 'mode' says otherwise. The caller has already taken the
+ * reference for the mapping.
+ */
+static unsigned long put_shared_page(unsigned long page,unsigned long address,
+	int mode)
+{
+	unsigned long *page_table;
+
+	if (!(page_table = get_page_table(address)))
 		return 0;
-	for (p = &LAST_TASK ; p > &FIRST_TASK ; --p) {
-		if (!*p)
+	page_table[(address>>12) & 0x3ff] = page | mode;
+	return page;
+}
+
+/*
+ * Having served a fault, also map any cached neighbours of the page
+ * that are not mapped yet, so a process starting up takes one fault
+ * per FAULT_AROUND pages instead of one per page. Only page tables that
+ * already exist and are not shared are filled in.
+ */
+static void fault_around(unsigned long index)
+{
+	unsigned long i, page, address, * page_table;
+
+	for (i = index & ~(FAULT_AROUND-1) ;
+	     i < (index | (FAULT_AROUND-1)) + 1 ; i++) {
+		if (i == index || (i << 12) >= current->end_data)
 			continue;
-		if (current == *p)
+		address = current->start_code + (i << 12);
+		page_table = cur_dir_entry(address);
+		if ((*page_table & 3) != 3)
 			continue;
-		if ((*p)->executable != current->executable)
+		page_table = (unsigned long *) (0xfffff000 & *page_table);
+		page_table += (address>>12) & 0x3ff;
+		if (*page_table)
 			continue;
-		if (try_to_share(address,*p))
-			return 1;
+		if (!(page = find_cached_page(current->executable,1+(i<<2))))
+			continue;
+		*page_table = page | 5;
+		nr_around++;
 	}
-	return 0;
 }
 
-void do_no_page(unsigned long error_code,unsigned long address)
+/*
+ * Start reading the blocks of the next few pages after the one at
+ * 'block' that are not cached, so that the faults the process is about
+ * to take find them in the buffer cache. 'size' is how many bytes from
+ * 'block' on are mapped.
+ */
+static void read_ahead_pages(struct m_inode * inode, unsigned long block,
+	long size)
+{
+	unsigned long i, page;
+	int j, nr;
+
+	for (i = 1 ; i < FAULT_AROUND ; i++) {
+		if ((long) (i << 12) >= size)
+			break;
+		if ((page = find_cached_page(inode,block+(i<<2)))) {
+			free_page(page);
+			continue;
+		}
+		for (j = 0 ; j < 4 ; j++)
+			if ((nr = bmap(inode,block+(i<<2)+j)))
+				reada_block(inode->i_dev,nr);
+	}
+}
+
+/*
+ * Get the page of 'inode' that starts at 'block', from the page cache
+ * or read in and added to it, with everything from byte 'size' of the
+ * page on cleared. The caller gets a reference. Returns 0 if out of
+ * memory.
+ */
+static unsigned long get_file_page(struct m_inode * inode,
+	unsigned long block, long size)
 {
 	int nr[4];
-	unsigned long tmp;
-	unsigned long page;
-	int block,i;
+	unsigned long page, cached, tmp;
+	int i;
+
+	if ((page = find_cached_page(inode,block))) {
+		nr_cache_hits++;
+		return page;
+	}
+	nr_cache_misses++;
+/* bread_page() fills all of it, holes included */
+	if (!(page = get_dirty_page_wait()))
+		return 0;
+	for (i=0 ; i<4 ; i++)
+		nr[i] = bmap(inode,block+i);
+	bread_page(page,inode->i_dev,nr);
+	i = 4096 - ((size < 0) ? 0 : size);
+	tmp = page + 4096;
+	while (i-- > 0) {
+		tmp--;
+		*(char *)tmp = 0;
+	}
+	read_ahead_pages(inode,block,size);
+	if ((cached = add_cached_page(inode,block,page)))
+		return cached;
+	return page;
+}
+
+/*
+ * A page of a mapped file: private mappings get it read-only, so that
+ * writes copy it, shared writable ones write to the cached page itself
+ * and unmap_area() writes it back.
+ */
+static void do_mmap_page(struct vm_area * vma, unsigned long address,
+	unsigned long tmp)
+{
+	unsigned long page, offset;
+	int mode = 5;
+
+	offset = vma->offset + (tmp - vma->start);
+	if ((vma->flags & MAP_SHARED) && (vma->prot & PROT_WRITE))
+		mode = 7;
+	if (!(page = get_file_page(vma->inode,offset/BLOCK_SIZE,
+	    vma->inode->i_size - (long) offset)))
+		oom();
+	if (!put_shared_page(page,address,mode)) {
+		free_page(page);
+		oom();
+	}
+}
+
+void do_no_page(unsigned long error_code,unsigned long address)
+{
+	unsigned long tmp, index;
+	unsigned long page, * table;
+	struct vm_area * vma;
 
 	address &= 0xfffff000;
+	table = cur_dir_entry(address);
+	if ((*table & 1) && ((unsigned long *) (0xfffff000 & *table))
+	    [(address>>12) & 0x3ff]) {
+/* not present, but not empty either: it is on swap */
+		if (!(table = get_page_table(address)) ||
+		    !swap_in(table + ((address>>12) & 0x3ff)))
+			oom();
+		return;
+	}
 	tmp = address - current->start_code;
+	if ((vma = find_vma(tmp))) {
+		do_mmap_page(vma,address,tmp);
+		return;
+	}
 	if (!current->executable || tmp >= current->end_data) {
 		get_empty_page(address);
 		return;
 	}
-	if (share_page(tmp))
-		return;
-	if (!(page = get_free_page()))
-		oom();
+	index = tmp >> 12;
 /* remember that 1 block is used for header */
-	block = 1 + tmp/BLOCK_SIZE;
-	for (i=0 ; i<4 ; block++,i++)
-		nr[i] = bmap(current->executable,block);
-	bread_page(page,current->executable->i_dev,nr);
-	i = tmp + 4096 - current->end_data;
-	tmp = page + 4096;
-	while (i-- > 0) {
-		tmp--;
-		*(char *)tmp = 0;
+	if (!(page = get_file_page(current->executable,1 + tmp/BLOCK_SIZE,
+	    current->end_data - tmp)))
+		oom();
+	if (!put_shared_page(page,address,5)) {
+		free_page(page);
+		oom();
 	}
-	if (put_page(page,address))
-		return;
-	free_page(page);
-	oom();
+	fault_around(index);
 }
 
+/*
+ * The current task's entry for 'address', in a page table of its own,
+ * or NULL if there is no page table there.
+ */
+unsigned long * find_pte(unsigned long address)
+{
+	unsigned long * dir = cur_dir_entry(address);
+
+	if (!(*dir & 1))
+		return NULL;
+	if (!unshare_page_table(dir))
+		oom();
+	return (unsigned long *) (0xfffff000 & *dir) + ((address>>12) & 0x3ff);
+}
+
+/*
+ * head.s only maps the first 16MB. Map the rest of memory one-to-one
+ * with page tables taken from start_mem (which is below 16MB, so they
+ * can be written to), then put mem_map[], free_order[] and the page
+ * cache entries after them.
+ * Tasks live above this direct mapping, from TASK_BASE on, so no more
+ * than that much memory is used.
+ */
 void mem_init(long start_mem, long end_mem)
 {
-	int i;
+	unsigned long * table, addr;
+	long i;
 
+	for (addr = 0x1000000 ; addr < end_mem ; addr += 0x400000) {
+		table = (unsigned long *) start_mem;
+		start_mem += 4096;
+		for (i=0 ; i<1024 ; i++)
+			table[i] = (addr + (i << 12)) | 7;
+		pg_dir[addr >> 22] = (unsigned long) table | 7;
+	}
+	invalidate();
 	HIGH_MEMORY = end_mem;
-	for (i=0 ; i<PAGING_PAGES ; i++)
+	nr_pages = MAP_NR(end_mem);
+	mem_map = (unsigned char *) start_mem;
+	free_order = mem_map + nr_pages;
+	cache_pages = (struct cache_page *) ((start_mem + 2*nr_pages + 3) & ~3);
+	nr_cache_pages = nr_pages/4;
+	start_mem = ((unsigned long) (cache_pages + nr_cache_pages) + 4095) & ~4095;
+	for (i=0 ; i<nr_pages ; i++) {
 		mem_map[i] = USED;
-	i = MAP_NR(start_mem);
-	end_mem -= start_mem;
-	end_mem >>= 12;
-	while (end_mem-->0)
-		mem_map[i++]=0;
+		free_order[i] = 0;
+	}
+	for (i=0 ; i<nr_cache_pages ; i++) {
+		cache_pages[i].page = 0;
+		cache_pages[i].next = free_cache_pages;
+		free_cache_pages = cache_pages + i;
+	}
+	for (i=MAP_NR(start_mem) ; i<nr_pages ; i++) {
+		mem_map[i] = 0;
+		release_block(i,0);
+	}
 }
 
 void calc_mem(void)
 {
 	int i,j,k,free=0;
 	long * pg_tbl;
+	unsigned long * dir = (unsigned long *) current->tss.cr3;
 
-	for(i=0 ; i<PAGING_PAGES ; i++)
+	for(i=0 ; i<nr_pages ; i++)
 		if (!mem_map[i]) free++;
-	printk("%d pages free (of %d)\n\r",free,PAGING_PAGES);
-	for(i=2 ; i<1024 ; i++) {
-		if (1&pg_dir[i]) {
-			pg_tbl=(long *) (0xfffff000 & pg_dir[i]);
+	printk("%d pages free (of %d)\n\r",free,nr_pages);
+	for(i=0 ; i<MAX_ORDER ; i++) {
+		struct page_block * b;
+
+		for (j=0,b=free_area[i] ; b ; b=b->next)
+			j++;
+		printk("order %d: %d free\n\r",i,j);
+	}
+	printk("%d pre-zeroed pages\n\r",nr_zeroed);
+	printk("page cache: %d pages, %d hits, %d misses, %d mapped around\n\r",
+		nr_cached,nr_cache_hits,nr_cache_misses,nr_around);
+#ifdef ALLOC_STATS
+	printk("alloc cycles (log2): pool/clear/dirty\n\r");
+	for(i=0 ; i<NR_LAT_BUCKETS ; i++)
+		if (alloc_lat[0][i] || alloc_lat[1][i] || alloc_lat[2][i])
+			printk("%2d: %d/%d/%d\n\r",i,alloc_lat[0][i],
+				alloc_lat[1][i],alloc_lat[2][i]);
+#endif
+	for(i=TASK_BASE>>22 ; i<1024 ; i++) {
+		if (1&dir[i]) {
+			pg_tbl=(long *) (0xfffff000 & dir[i]);
 			for(j=k=0 ; j<1024 ; j++)
 				if (pg_tbl[j]&1)
 					k++;
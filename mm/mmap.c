@@ -0,0 +1,423 @@
+/*
+ *  linux/mm/mmap.c
+ */
+
+/*
+ * Mapping regular files into memory. mmap() only records the mapping in
+ * current->mmap[]: do_no_page() finds it with find_vma() and brings the
+ * pages in through the page cache, with the same bmap()/bread_page() as
+ * executables use. Private mappings get a copy of a page when it is
+ * written to. Shared writable ones write to the cached page itself, and
+ * its dirty pages go back to the file through the buffer cache when
+ * they are unmapped (by munmap(), exec() or exit()), and meanwhile by
+ * sync_mappings(): sync() and bdflush have them written to disk, and
+ * read() of the file sees them.
+ *
+ * As a whole page is written back, write() to the file also copies what
+ * it writes into the pages that shared writable mappings have of it, so
+ * that is not lost when they go back. For the same reason such pages
+ * are never swapped out. Each mapping still has a page of its own once
+ * the page cache has let go of it, though: two tasks that map the same
+ * file don't see each other's changes until it is mapped again.
+ *
+ * A vfork()ed child sees its parent's mappings, without references of
+ * its own to the files, and may not change them.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <asm/segment.h>
+
+#define shared_write(vma) \
+(((vma)->flags & MAP_SHARED) && ((vma)->prot & PROT_WRITE))
+
+/* take and drop the reference a mapping has to its file */
+void get_vma(struct vm_area * vma)
+{
+	vma->inode->i_count++;
+	if (shared_write(vma))
+		vma->inode->i_wmaps++;
+}
+
+static void put_vma(struct vm_area * vma)
+{
+	if (shared_write(vma))
+		vma->inode->i_wmaps--;
+	iput(vma->inode);
+}
+
+struct vm_area * find_vma(unsigned long addr)
+{
+	struct vm_area * vma = current->mmap;
+	int i;
+
+	for (i = 0 ; i < current->nr_mmap ; i++,vma++)
+		if (addr < vma->end)
+			return (addr >= vma->start) ? vma : NULL;
+	return NULL;
+}
+
+/*
+ * Copy the page mapped at 'addr' in 'vma' into the blocks of the file
+ * it came from, leaving the buffers dirty. Nothing goes past the end of
+ * the file.
+ */
+static void write_page(struct vm_area * vma, unsigned long addr,
+	unsigned long page)
+{
+	struct m_inode * inode = vma->inode;
+	struct buffer_head * bh;
+	unsigned long pos;
+	int i, block, chars;
+
+	pos = vma->offset + (addr - vma->start);
+	for (i = 0 ; i < 4 ; i++,pos += BLOCK_SIZE,page += BLOCK_SIZE) {
+		if (pos >= inode->i_size)
+			break;
+		if (!(block = create_block(inode,pos/BLOCK_SIZE)))
+			break;
+		if (!(bh = bread(inode->i_dev,block)))
+			break;
+		chars = inode->i_size - pos;
+		if (chars > BLOCK_SIZE)
+			chars = BLOCK_SIZE;
+		memcpy(bh->b_data,(char *) page,chars);
+		bh->b_dirt = 1;
+		brelse(bh);
+		inode->i_mtime = CURRENT_TIME;
+		inode->i_dirt = 1;
+	}
+}
+
+/*
+ * Throw away the pages of 'vma' between 'from' and 'to', writing the
+ * dirty ones back first if it is shared and writable. write_page() can
+ * sleep, so the page gets a reference of ours meanwhile (which keeps
+ * swap_out() off it) and the entry is looked up again afterwards.
+ */
+static void unmap_area(struct vm_area * vma, unsigned long from,
+	unsigned long to)
+{
+	unsigned long addr, * pte, page;
+	int writeback = shared_write(vma);
+
+	for (addr = from ; addr < to ; addr += PAGE_SIZE) {
+		if (!(pte = find_pte(current->start_code + addr)) || !*pte)
+			continue;
+		if (writeback && !(*pte & PAGE_PRESENT)) {
+			if (!swap_in(pte))
+				printk("unmap_area: out of memory, page lost\n\r");
+			pte = find_pte(current->start_code + addr);
+		}
+		if (writeback && (*pte & PAGE_DIRTY) && (*pte & PAGE_PRESENT)) {
+			page = 0xfffff000 & *pte;
+			mem_map[MAP_NR(page)]++;
+			write_page(vma,addr,page);
+			free_page(page);
+			pte = find_pte(current->start_code + addr);
+		}
+		if (*pte & PAGE_PRESENT)
+			free_page(0xfffff000 & *pte);
+		else if (*pte)
+			swap_free(*pte);
+		*pte = 0;
+	}
+	invalidate();
+}
+
+/*
+ * Unmap whatever is mapped between 'start' and 'end', trimming or
+ * splitting mappings that are partly inside.
+ */
+static int do_munmap(unsigned long start, unsigned long end)
+{
+	struct vm_area * vma;
+	unsigned long from, to;
+	int i;
+
+	for (i = 0 ; i < current->nr_mmap ; ) {
+		vma = current->mmap + i;
+		if (vma->end <= start || vma->start >= end) {
+			i++;
+			continue;
+		}
+		from = (start > vma->start) ? start : vma->start;
+		to = (end < vma->end) ? end : vma->end;
+		if (from > vma->start && to < vma->end) {
+			if (current->nr_mmap >= NR_MMAP)
+				return -ENOMEM;
+			memmove(vma+1,vma,(current->nr_mmap-i)*sizeof(*vma));
+			current->nr_mmap++;
+			vma[1].start = to;
+			vma[1].offset += to - vma->start;
+			get_vma(vma);
+			unmap_area(vma,from,to);
+			vma->end = from;
+			i += 2;
+			continue;
+		}
+		unmap_area(vma,from,to);
+		if (from == vma->start && to == vma->end) {
+			put_vma(vma);
+			current->nr_mmap--;
+			memmove(vma,vma+1,(current->nr_mmap-i)*sizeof(*vma));
+			continue;
+		}
+		if (from == vma->start) {
+			vma->offset += to - from;
+			vma->start = to;
+		} else
+			vma->end = from;
+		i++;
+	}
+	return 0;
+}
+
+/* the lowest gap of 'len' bytes between the mappings, 0 if none */
+static unsigned long get_unmapped_area(unsigned long len)
+{
+	unsigned long addr = MMAP_BASE;
+	int i;
+
+	for (i = 0 ; i < current->nr_mmap ; i++) {
+		if (len <= current->mmap[i].start - addr)
+			break;
+		addr = current->mmap[i].end;
+	}
+	if (len > MMAP_END - addr)
+		return 0;
+	return addr;
+}
+
+/*
+ * The arguments come in a buffer, as there are more of them than
+ * system calls take: addr, len, prot, flags, fd and offset.
+ */
+int sys_mmap(unsigned long * buffer)
+{
+	unsigned long addr, len, off;
+	int prot, flags, fd, i, error;
+	struct file * file;
+	struct vm_area * vma;
+
+	addr = get_fs_long(buffer);
+	len = get_fs_long(buffer+1);
+	prot = get_fs_long(buffer+2);
+	flags = get_fs_long(buffer+3);
+	fd = get_fs_long(buffer+4);
+	off = get_fs_long(buffer+5);
+	if (current->vfork)
+		return -EINVAL;
+	if (fd < 0 || fd >= NR_OPEN || !(file = current->filp[fd]))
+		return -EBADF;
+	if (!S_ISREG(file->f_inode->i_mode))
+		return -ENODEV;
+	if ((off & 0xfff) || (long) off < 0)
+		return -EINVAL;
+	if (!len || (len = (len + 0xfff) & 0xfffff000) == 0)
+		return -EINVAL;
+	if ((file->f_flags & O_ACCMODE) == O_WRONLY)
+		return -EACCES;
+	switch (flags & (MAP_SHARED | MAP_PRIVATE)) {
+		case MAP_SHARED:
+			if ((prot & PROT_WRITE) &&
+			    (file->f_flags & O_ACCMODE) == O_RDONLY)
+				return -EACCES;
+			break;
+		case MAP_PRIVATE:
+			break;
+		default:
+			return -EINVAL;
+	}
+	if (flags & MAP_FIXED) {
+		if ((addr & 0xfff) || addr < MMAP_BASE || addr > MMAP_END ||
+		    len > MMAP_END - addr)
+			return -EINVAL;
+		if ((error = do_munmap(addr,addr+len)))
+			return error;
+	} else if (!(addr = get_unmapped_area(len)))
+		return -ENOMEM;
+	if (current->nr_mmap >= NR_MMAP)
+		return -ENOMEM;
+	for (i = current->nr_mmap ; i > 0 && current->mmap[i-1].start > addr ; i--)
+		current->mmap[i] = current->mmap[i-1];
+	vma = current->mmap + i;
+	vma->start = addr;
+	vma->end = addr + len;
+	vma->inode = file->f_inode;
+	vma->offset = off;
+	vma->prot = prot;
+	vma->flags = flags & (MAP_SHARED | MAP_PRIVATE);
+	get_vma(vma);
+	current->nr_mmap++;
+	return addr;
+}
+
+int sys_munmap(unsigned long addr, unsigned long len)
+{
+	if (current->vfork || (addr & 0xfff) || !len || len > TASK_SIZE - addr)
+		return -EINVAL;
+	return do_munmap(addr,addr + ((len + 0xfff) & 0xfffff000));
+}
+
+/*
+ * write() has put 'count' bytes from 'data' at 'pos' in the file of
+ * 'inode': copy them into the pages that shared writable mappings of it
+ * have there. This doesn't sleep, so the page tables can be looked at
+ * as they are. vfork()ed children share their parent's.
+ */
+void update_mapped_pages(struct m_inode * inode, unsigned long pos,
+	const char * data, int count)
+{
+	struct task_struct * p;
+	struct vm_area * vma;
+	unsigned long from, to, addr, * dir, pte;
+	int i, j, chars;
+
+	if (!inode->i_wmaps)
+		return;
+	for (i = 0 ; i < NR_TASKS ; i++) {
+		if (!(p = task[i]) || !p->tss.cr3 || p->vfork)
+			continue;
+		for (j = 0, vma = p->mmap ; j < p->nr_mmap ; j++,vma++) {
+			if (vma->inode != inode || !shared_write(vma))
+				continue;
+			from = (pos > vma->offset) ? pos : vma->offset;
+			to = vma->offset + (vma->end - vma->start);
+			if (to > pos + count)
+				to = pos + count;
+			for ( ; from < to ; from = (from + PAGE_SIZE) & 0xfffff000) {
+				addr = p->start_code + vma->start + from - vma->offset;
+				dir = dir_entry(p->tss.cr3,addr);
+				if (!(*dir & 1))
+					continue;
+				pte = ((unsigned long *) (0xfffff000 & *dir))
+					[(addr >> 12) & 0x3ff];
+				if (!(pte & PAGE_PRESENT))
+					continue;
+				chars = ((from | 0xfff) + 1 < to) ?
+					PAGE_SIZE - (from & 0xfff) : to - from;
+				memcpy((char *) (0xfffff000 & pte) + (from & 0xfff),
+					data + (from - pos),chars);
+			}
+		}
+	}
+}
+
+/*
+ * Copy the dirty pages of shared writable mappings into the buffer
+ * cache, for sync() and bdflush, or only those of 'inode' for read().
+ * A page's dirty bit is cleared before it is copied, so a store to it
+ * meanwhile is caught the next time. write_page() sleeps, so the file
+ * and the page get references of ours, and the task and its mapping
+ * are checked again for every page.
+ */
+void sync_mappings(struct m_inode * inode)
+{
+	struct task_struct * p;
+	struct vm_area vma, * tmp;
+	unsigned long addr, * dir, * pte, page;
+	long pid;
+	int i, j;
+
+	if (inode && !inode->i_wmaps)
+		return;
+	for (i = 0 ; i < NR_TASKS ; i++)
+		for (j = 0 ; (p = task[i]) && j < p->nr_mmap ; j++) {
+			if (!p->tss.cr3 || p->vfork)
+				break;
+			vma = p->mmap[j];
+			if (!shared_write(&vma) || (inode && vma.inode != inode))
+				continue;
+			pid = p->pid;
+			vma.inode->i_count++;
+			for (addr = vma.start ; addr < vma.end ; addr += PAGE_SIZE) {
+				tmp = p->mmap + j;
+				if (task[i] != p || p->pid != pid || j >= p->nr_mmap ||
+				    tmp->start != vma.start || tmp->end != vma.end ||
+				    tmp->inode != vma.inode)
+					break;
+				dir = dir_entry(p->tss.cr3,p->start_code + addr);
+				if (!(*dir & 1))
+					continue;
+				pte = (unsigned long *) (0xfffff000 & *dir) +
+					(((p->start_code + addr) >> 12) & 0x3ff);
+				if ((*pte & (PAGE_PRESENT | PAGE_DIRTY)) !=
+				    (PAGE_PRESENT | PAGE_DIRTY))
+					continue;
+				page = 0xfffff000 & *pte;
+				*pte &= ~PAGE_DIRTY;
+				if (p->tss.cr3 == current->tss.cr3)
+					invalidate();
+				mem_map[MAP_NR(page)]++;
+				write_page(&vma,addr,page);
+				free_page(page);
+			}
+			iput(vma.inode);
+		}
+}
+
+/* is 'addr' (linear) in a shared writable mapping of task p? */
+int shared_write_page(struct task_struct * p, unsigned long addr)
+{
+	struct vm_area * vma;
+	int i;
+
+	addr -= p->start_code;
+	for (i = 0, vma = p->mmap ; i < p->nr_mmap ; i++,vma++)
+		if (addr >= vma->start && addr < vma->end)
+			return shared_write(vma);
+	return 0;
+}
+
+/*
+ * Write back the dirty pages of a shared writable 'vma', for
+ * exit_mmap(). The page tables are only looked at, not unshared, as
+ * that could take memory: the pages are left for free_page_tables().
+ */
+static void writeback_area(struct vm_area * vma)
+{
+	unsigned long addr, * dir, * pte, page;
+
+	for (addr = vma->start ; addr < vma->end ; addr += PAGE_SIZE) {
+		dir = cur_dir_entry(current->start_code + addr);
+		if (!(*dir & 1))
+			continue;
+		pte = (unsigned long *) (0xfffff000 & *dir) +
+			(((current->start_code + addr) >> 12) & 0x3ff);
+/* swap_in() only works on tables of our own */
+		if (*pte && !(*pte & PAGE_PRESENT) && (*dir & 3) == 3 &&
+		    mem_map[MAP_NR(0xfffff000 & *dir)] == 1 && !swap_in(pte))
+			printk("exit_mmap: out of memory, page lost\n\r");
+		if ((*pte & (PAGE_PRESENT | PAGE_DIRTY)) !=
+		    (PAGE_PRESENT | PAGE_DIRTY))
+			continue;
+		page = 0xfffff000 & *pte;
+		mem_map[MAP_NR(page)]++;
+		write_page(vma,addr,page);
+		free_page(page);
+	}
+}
+
+/*
+ * Drop all mappings of the current task, writing back shared ones, as
+ * exec() and exit() do just before free_page_tables(). Each mapping is
+ * taken off the list before anything is done with it, so this can't
+ * go round in circles should the task die meanwhile.
+ */
+void exit_mmap(void)
+{
+	struct vm_area * vma;
+
+	while (current->nr_mmap > 0) {
+		vma = current->mmap + --current->nr_mmap;
+		if (shared_write(vma))
+			writeback_area(vma);
+		put_vma(vma);
+	}
+}
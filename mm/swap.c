@@ -0,0 +1,296 @@
+/*
+ *  linux/mm/swap.c
+ */
+
+/*
+ * Swapping to a block device. sys_swapon() reads the swap header from
+ * page 0 of the device: mkswap leaves "SWAP-SPACE" in its last ten bytes
+ * and a bitmap of the usable pages in front of that. swap_map[] counts
+ * the page table entries that refer to each swap page (there can be
+ * several once a page table shared by fork() has been copied), or is
+ * SWAP_BAD for pages that cannot be used.
+ *
+ * swap_out() picks its victims like a clock: it goes round the pages of
+ * all tasks, and a page whose accessed bit is set has the bit cleared
+ * and is passed over until the next time round.
+ */
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <asm/system.h>
+
+#define SWAP_BITS ((PAGE_SIZE-10)<<3)
+#define SWAP_BAD 0xffff
+#define SWAP_MAP_ORDER 4	/* SWAP_BITS shorts fit in 16 pages */
+
+int swap_dev = 0;
+static unsigned short * swap_map = NULL;
+static int swap_max = 0;	/* pages below this may be in use */
+static int swap_next = 1;
+static int nr_swap_free = 0;
+static long nr_swapped_out = 0, nr_swapped_in = 0;
+
+#define read_swap_page(nr,buffer) \
+ll_rw_page(READ,swap_dev,(nr),(char *) (buffer))
+#define write_swap_page(nr,buffer) \
+ll_rw_page(WRITE,swap_dev,(nr),(char *) (buffer))
+
+static inline int bit(char * addr,unsigned int nr)
+{
+	return (addr[nr >> 3] >> (nr & 7)) & 1;
+}
+
+static int get_swap_page(void)
+{
+	int i, nr;
+
+	for (i = 1 ; i < swap_max ; i++) {
+		nr = swap_next;
+		if (++swap_next >= swap_max)
+			swap_next = 1;
+		if (!swap_map[nr]) {
+			swap_map[nr] = 1;
+			nr_swap_free--;
+			return nr;
+		}
+	}
+	return 0;
+}
+
+void swap_free(unsigned long entry)
+{
+	unsigned long nr = SWP_NR(entry);
+
+	if (!nr || nr >= swap_max || !swap_map[nr] || swap_map[nr] == SWAP_BAD) {
+		printk("swap_free: bad swap page %d\n\r",nr);
+		return;
+	}
+	if (!--swap_map[nr])
+		nr_swap_free++;
+}
+
+void swap_duplicate(unsigned long entry)
+{
+	unsigned long nr = SWP_NR(entry);
+
+	if (!nr || nr >= swap_max || !swap_map[nr] || swap_map[nr] == SWAP_BAD) {
+		printk("swap_duplicate: bad swap page %d\n\r",nr);
+		return;
+	}
+	if (swap_map[nr] == SWAP_BAD-1)
+		panic("swap_duplicate: too many references");
+	swap_map[nr]++;
+}
+
+/*
+ * Bring back the page the (not present) entry points at. The entry must
+ * be in a page table of the current task's own. Returns 0 if out of
+ * memory, or the page couldn't be read: the entry is left as it is.
+ */
+int swap_in(unsigned long * table_entry)
+{
+	unsigned long entry = *table_entry, page;
+	int error = 0;
+
+	if (!(page = get_dirty_page_wait()))
+		return 0;
+	if (*table_entry == entry)
+		error = read_swap_page(SWP_NR(entry),page);
+	if (*table_entry != entry) {
+		free_page(page);
+		return 1;
+	}
+	if (error) {
+		printk("swap_in: can't read swap page %d\n\r",SWP_NR(entry));
+		free_page(page);
+		return 0;
+	}
+	*table_entry = page | PAGE_DIRTY | PAGE_USER | PAGE_PRESENT |
+		(entry & PAGE_RW);
+	swap_free(entry);
+	nr_swapped_in++;
+	return 1;
+}
+
+/*
+ * The entry for 'addr' in task p, if its page table is there and not
+ * shared with another task.
+ */
+static unsigned long * task_pte(struct task_struct * p, unsigned long addr)
+{
+	unsigned long * dir = dir_entry(p->tss.cr3,addr);
+
+	if ((*dir & 3) != 3 || mem_map[MAP_NR(0xfffff000 & *dir)] != 1)
+		return NULL;
+	return (unsigned long *) (0xfffff000 & *dir) + ((addr >> 12) & 0x3ff);
+}
+
+/*
+ * p's page tables are the ones in the TLB if it runs on current's page
+ * directory: p is current, or a vfork() parent while its child runs.
+ */
+#define flush_for(p) \
+do { if ((p)->tss.cr3 == current->tss.cr3) invalidate(); } while (0)
+
+/*
+ * Write the page at 'addr' in p out and unmap it. The page stays mapped
+ * while it is written, with its dirty bit cleared: if p writes to it or
+ * lets go of it meanwhile, the swap page is thrown away instead.
+ */
+static int try_to_swap_out(struct task_struct * p, unsigned long addr)
+{
+	unsigned long * pte, page;
+	long pid = p->pid;
+	int slot = p->nr, nr;
+
+	pte = task_pte(p,addr);
+	page = 0xfffff000 & *pte;
+	if (!(nr = get_swap_page()))
+		return 0;
+	mem_map[MAP_NR(page)]++;
+	*pte &= ~PAGE_DIRTY;
+	flush_for(p);
+	if (write_swap_page(nr,page)) {
+/* keep the page, and stay off that part of the swap device */
+		swap_map[nr] = SWAP_BAD;
+		free_page(page);
+		return 0;
+	}
+	if (task[slot] == p && p->pid == pid && (pte = task_pte(p,addr)) &&
+	    (*pte & (0xfffff000 | PAGE_DIRTY | PAGE_PRESENT)) ==
+	    (page | PAGE_PRESENT) && mem_map[MAP_NR(page)] == 2) {
+		*pte = SWP_ENTRY(nr,*pte);
+		flush_for(p);
+		free_page(page);
+		free_page(page);
+		nr_swapped_out++;
+		return 1;
+	}
+	swap_free(SWP_ENTRY(nr,0));
+	free_page(page);
+	return 0;
+}
+
+/*
+ * Free a page by writing one out to swap. Only pages that belong to a
+ * single task are taken. Returns 0 if there is no swap space, or if
+ * nothing could be found after going round everything a few times.
+ */
+int swap_out(void)
+{
+	static int swap_task = 1;
+	static unsigned long swap_addr = TASK_BASE;
+	struct task_struct * p;
+	unsigned long * pte, page;
+	int passes = 0;
+
+	if (!swap_dev || !nr_swap_free)
+		return 0;
+	for (;;) {
+		if (swap_addr < TASK_BASE || swap_addr >= TASK_BASE+TASK_SIZE) {
+			swap_addr = TASK_BASE;
+			if (++swap_task >= NR_TASKS) {
+				swap_task = 1;
+				if (++passes > 2)
+					return 0;
+			}
+		}
+		p = task[swap_task];
+		if (!p || !p->tss.cr3 || p->vfork || p->state == TASK_ZOMBIE) {
+			swap_addr = TASK_BASE+TASK_SIZE;
+			continue;
+		}
+		if (!(pte = task_pte(p,swap_addr))) {
+			swap_addr = (swap_addr + 0x400000) & 0xffc00000;
+			continue;
+		}
+		swap_addr += PAGE_SIZE;
+		page = *pte;
+		if (!(page & PAGE_PRESENT))
+			continue;
+		if (page & PAGE_ACCESSED) {
+			*pte &= ~PAGE_ACCESSED;
+			flush_for(p);
+			continue;
+		}
+		page &= 0xfffff000;
+		if (page < LOW_MEM || page >= HIGH_MEMORY ||
+		    mem_map[MAP_NR(page)] != 1)
+			continue;
+/* write() keeps these up to date, see mmap.c */
+		if (shared_write_page(p,swap_addr-PAGE_SIZE))
+			continue;
+		if (try_to_swap_out(p,swap_addr-PAGE_SIZE))
+			return 1;
+	}
+}
+
+int sys_swapon(const char * specialfile)
+{
+	struct m_inode * inode;
+	unsigned short * map;
+	char * header;
+	int dev, i, nr = 0, max = 0;
+
+	if (!suser())
+		return -EPERM;
+	if (!(inode = namei(specialfile)))
+		return -ENOENT;
+	dev = inode->i_zone[0];
+	if (!S_ISBLK(inode->i_mode)) {
+		iput(inode);
+		return -ENOTBLK;
+	}
+	iput(inode);
+/* ll_rw_page() needs a driver that takes whole pages */
+	if (MAJOR(dev) != 1 && MAJOR(dev) != 3)
+		return -EINVAL;
+	if (swap_dev)
+		return -EBUSY;
+	if (!(header = (char *) get_free_page()))
+		return -ENOMEM;
+	if (!(map = (unsigned short *) get_free_pages(SWAP_MAP_ORDER))) {
+		free_page((unsigned long) header);
+		return -ENOMEM;
+	}
+	if (ll_rw_page(READ,dev,0,header)) {
+		free_pages((unsigned long) map,SWAP_MAP_ORDER);
+		free_page((unsigned long) header);
+		return -EIO;
+	}
+	if (strncmp(header+PAGE_SIZE-10,"SWAP-SPACE",10)) {
+		printk("Unable to find swap-space signature\n\r");
+		free_pages((unsigned long) map,SWAP_MAP_ORDER);
+		free_page((unsigned long) header);
+		return -EINVAL;
+	}
+	for (i = 0 ; i < SWAP_BITS ; i++)
+		if (i && bit(header,i)) {
+			map[i] = 0;
+			max = i+1;
+			nr++;
+		} else
+			map[i] = SWAP_BAD;
+	free_page((unsigned long) header);
+	if (!nr || swap_dev) {
+		free_pages((unsigned long) map,SWAP_MAP_ORDER);
+		return nr ? -EBUSY : -EINVAL;
+	}
+	swap_map = map;
+	swap_max = max;
+	nr_swap_free = nr;
+	swap_dev = dev;
+	printk("Adding swap: %d pages (%dkB) on %04x\n\r",nr,nr*4,dev);
+	return 0;
+}
+
+void show_swap_stat(void)
+{
+	if (!swap_dev)
+		return;
+	printk("swap %04x: %d of %d pages free, %d out, %d in\n\r",
+		swap_dev,nr_swap_free,swap_max-1,nr_swapped_out,nr_swapped_in);
+}